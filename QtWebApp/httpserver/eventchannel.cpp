@@ -0,0 +1,107 @@
+#include "eventchannel.h"
+
+#include "eventstream.h"
+
+#include <QMetaType>
+
+using namespace qtwebapp;
+
+EventChannel *EventChannel::get(const QByteArray &name) {
+	static QMutex registryMutex;
+	static QHash<QByteArray, EventChannel *> registry;
+	QMutexLocker locker(&registryMutex);
+	EventChannel *channel = registry.value(name);
+	if (!channel) {
+		channel = new EventChannel(name);
+		registry.insert(name, channel);
+	}
+	return channel;
+}
+
+EventChannel::EventChannel(const QByteArray &name) : name(name) {
+	maxQueuedEvents.storeRelease(100);
+	dropPolicy.storeRelease(dropOldest);
+	heartbeatInterval.storeRelease(15000);
+	subscriberCount.storeRelease(0);
+	qRegisterMetaType<QTcpSocket *>("QTcpSocket*");
+}
+
+bool EventChannel::subscribe(HttpResponse &response) {
+	if (response.http2 || response.pipelined || response.sentHeaders) {
+		qWarning("EventChannel (%s): cannot subscribe a response that has been written, belongs to HTTP/2 or to "
+		         "a pipelined request",
+		         name.constData());
+		return false;
+	}
+	// The body ends when the connection is closed, so neither Content-Length nor chunked mode is needed
+	response.setHeader("Content-Type", "text/event-stream");
+	response.setHeader("Cache-Control", "no-cache");
+	response.setHeader("Connection", "close");
+	response.sendBody(QByteArray(), false);
+	response.socket->flush();
+	response.eventChannel = this;
+	return true;
+}
+
+EventStream *EventChannel::attach(QTcpSocket *socket, QThread *thread) {
+	QMutexLocker locker(&mutex);
+	EventStream *stream = streams.value(thread);
+	if (!stream) {
+		stream = new EventStream(this);
+		QObject::connect(thread, SIGNAL(finished()), stream, SLOT(threadDone()));
+		stream->moveToThread(thread);
+		streams.insert(thread, stream);
+	}
+	socket->moveToThread(thread);
+	subscriberCount.ref();
+	QMetaObject::invokeMethod(stream, "addSubscriber", Qt::QueuedConnection, Q_ARG(QTcpSocket *, socket));
+#ifdef CMAKE_DEBUG
+	qDebug("EventChannel (%s): new subscriber", name.constData());
+#endif
+	return stream;
+}
+
+void EventChannel::removeStream(QThread *thread) {
+	QMutexLocker locker(&mutex);
+	streams.remove(thread);
+}
+
+void EventChannel::publish(const QByteArray &data, const QByteArray &event, const QByteArray &id) {
+	// Serialize the event once, all subscribers share the buffer
+	QByteArray serialized;
+	serialized.reserve(data.size() + event.size() + id.size() + 32);
+	if (!id.isEmpty()) {
+		serialized.append("id: ");
+		serialized.append(id);
+		serialized.append('\n');
+	}
+	if (!event.isEmpty()) {
+		serialized.append("event: ");
+		serialized.append(event);
+		serialized.append('\n');
+	}
+	foreach (const QByteArray &line, data.split('\n')) {
+		serialized.append("data: ");
+		serialized.append(line);
+		serialized.append('\n');
+	}
+	serialized.append('\n');
+
+	QMutexLocker locker(&mutex);
+	foreach (EventStream *stream, streams) {
+		QMetaObject::invokeMethod(stream, "deliver", Qt::QueuedConnection, Q_ARG(QByteArray, serialized));
+	}
+}
+
+void EventChannel::setQueueLimit(int maxEvents, DropPolicy policy) {
+	maxQueuedEvents.storeRelease(maxEvents);
+	dropPolicy.storeRelease(policy);
+}
+
+void EventChannel::setHeartbeatInterval(int msec) {
+	heartbeatInterval.storeRelease(msec);
+}
+
+int EventChannel::getSubscriberCount() const {
+	return subscriberCount.loadAcquire();
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "httpresponse.h"
+#include "qtwebappglobal.h"
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QTcpSocket>
+#include <QThread>
+
+namespace qtwebapp {
+
+	class EventStream;
+
+	/**
+	  A named channel of Server-Sent Events (text/event-stream). A request handler subscribes the response of a
+	  request to a channel in its service() method:
+	  <code><pre>
+	    void MyController::service(HttpRequest &request, HttpResponse &response) {
+	        EventChannel::get("ticker")->subscribe(response);
+	    }
+	  </pre></code>
+	  After service() returns, the connection is handed over to the I/O thread of the pool, so subscribers do
+	  not occupy a connection handler or a thread. Events can be published from any thread:
+	  <code><pre>
+	    EventChannel::get("ticker")->publish("{\"price\":42}", "price");
+	  </pre></code>
+	  Each event is serialized only once. All subscribers share the same buffer, which is copied to the
+	  socket of a subscriber only when the socket has sent its previous data. The queue of a subscriber that
+	  does not read fast enough is limited, see setQueueLimit(). Idle subscribers receive a comment line as
+	  heartbeat, which keeps proxies from closing the connection.
+	  <p>
+	  Channels are created on demand and never deleted. Server-Sent Events are not supported with HTTP/2.
+	*/
+	class QTWEBAPP_EXPORT EventChannel {
+		Q_DISABLE_COPY(EventChannel)
+		friend class EventStream;
+		friend class HttpConnectionHandler;
+
+	  public:
+		/** What to do when the queue of a subscriber is full */
+		enum DropPolicy {
+			/** Drop the oldest queued event */
+			dropOldest,
+			/** Drop the new event */
+			dropNewest,
+			/** Close the connection of the subscriber */
+			disconnectSubscriber
+		};
+
+		/**
+		  Get a channel, it is created if it does not exist. This method is thread safe.
+		  @param name Name of the channel
+		*/
+		static EventChannel *get(const QByteArray &name);
+
+		/**
+		  Subscribe the response of a request to this channel. The response headers are sent immediately,
+		  the response must not be written before or after.
+		  @return False if the response cannot be used for events, because it has been written or it belongs
+		  to a HTTP/2 stream or a request that is serviced concurrently with other pipelined requests
+		*/
+		bool subscribe(HttpResponse &response);
+
+		/**
+		  Send an event to all subscribers. This method is thread safe.
+		  @param data The data of the event, it may contain multiple lines
+		  @param event The type of the event, or empty for the default type "message"
+		  @param id The id of the event, or empty
+		*/
+		void publish(const QByteArray &data, const QByteArray &event = QByteArray(), const QByteArray &id = QByteArray());
+
+		/**
+		  Limit the number of events queued for a single subscriber. The default is 100 events, with dropOldest.
+		  This method is thread safe.
+		*/
+		void setQueueLimit(int maxEvents, DropPolicy policy);
+
+		/**
+		  Set the interval of heartbeats to idle subscribers in milliseconds, 0 disables heartbeats.
+		  The default is 15 seconds. This method is thread safe.
+		*/
+		void setHeartbeatInterval(int msec);
+
+		/** Get the number of subscribers */
+		int getSubscriberCount() const;
+
+	  private:
+		/** Constructor */
+		EventChannel(const QByteArray &name);
+
+		/** Name of the channel */
+		QByteArray name;
+
+		/** The subscribers, grouped by the thread that processes their connections */
+		QHash<QThread *, EventStream *> streams;
+
+		/** Used to synchronize threads */
+		QMutex mutex;
+
+		/** Maximum number of events queued for a subscriber */
+		QAtomicInt maxQueuedEvents;
+
+		/** What to do when the queue of a subscriber is full */
+		QAtomicInt dropPolicy;
+
+		/** Interval of heartbeats */
+		QAtomicInt heartbeatInterval;
+
+		/** Number of subscribers */
+		QAtomicInt subscriberCount;
+
+		/**
+		  Take over the connection of a subscribed response after the request handler returned.
+		  @return The stream that delivers the events to the connection
+		*/
+		EventStream *attach(QTcpSocket *socket, QThread *thread);
+
+		/** Remove the subscribers of a thread that finished */
+		void removeStream(QThread *thread);
+	};
+
+} // namespace qtwebapp
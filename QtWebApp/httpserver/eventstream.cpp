@@ -0,0 +1,142 @@
+#include "eventstream.h"
+
+#include "eventchannel.h"
+
+#include <QThread>
+
+using namespace qtwebapp;
+
+/** Events are passed to a socket only while its write buffer is smaller than this */
+static const qint64 socketBufferLimit = 16384;
+
+EventStream::EventStream(EventChannel *channel) : QObject(), channel(channel) {
+	heartbeatTimer = new QTimer(this);
+	connect(heartbeatTimer, SIGNAL(timeout()), SLOT(heartbeat()));
+}
+
+EventStream::~EventStream() {
+	foreach (QTcpSocket *socket, subscribers.keys()) {
+		socket->disconnect(this);
+		socket->abort();
+		delete socket;
+	}
+	channel->subscriberCount.fetchAndAddOrdered(-subscribers.size());
+}
+
+void EventStream::addSubscriber(QTcpSocket *socket) {
+	if (socket->state() != QAbstractSocket::ConnectedState) {
+		channel->subscriberCount.deref();
+		delete socket;
+		return;
+	}
+	Subscriber subscriber;
+	subscriber.active = true;
+	subscribers.insert(socket, subscriber);
+	connect(socket, SIGNAL(bytesWritten(qint64)), SLOT(bytesWritten()));
+	connect(socket, SIGNAL(readyRead()), SLOT(discardInput()));
+	connect(socket, SIGNAL(disconnected()), SLOT(disconnected()));
+	if (!heartbeatTimer->isActive() && channel->heartbeatInterval.loadAcquire() > 0) {
+		heartbeatTimer->start(channel->heartbeatInterval.loadAcquire());
+	}
+	// The client does not send anything after the request
+	socket->readAll();
+}
+
+void EventStream::deliver(const QByteArray &event) {
+	int maxQueuedEvents = channel->maxQueuedEvents.loadAcquire();
+	int dropPolicy = channel->dropPolicy.loadAcquire();
+	QList<QTcpSocket *> slowSubscribers;
+	for (QHash<QTcpSocket *, Subscriber>::iterator it = subscribers.begin(); it != subscribers.end(); ++it) {
+		Subscriber &subscriber = it.value();
+		if (subscriber.queue.size() >= maxQueuedEvents) {
+			if (dropPolicy == EventChannel::dropNewest) {
+				continue;
+			} else if (dropPolicy == EventChannel::disconnectSubscriber) {
+				slowSubscribers.append(it.key());
+				continue;
+			}
+			subscriber.queue.removeFirst();
+		}
+		subscriber.queue.append(event);
+		flush(it.key(), subscriber);
+	}
+	// Closing a connection removes the subscriber, so this cannot be done while iterating
+	foreach (QTcpSocket *socket, slowSubscribers) {
+		qWarning("EventStream (%p): subscriber does not read fast enough, closing the connection",
+		         static_cast<void *>(this));
+		socket->abort();
+	}
+}
+
+void EventStream::flush(QTcpSocket *socket, Subscriber &subscriber) {
+	while (!subscriber.queue.isEmpty() && socket->bytesToWrite() < socketBufferLimit) {
+		socket->write(subscriber.queue.takeFirst());
+		subscriber.active = true;
+	}
+}
+
+void EventStream::bytesWritten() {
+	QTcpSocket *socket = static_cast<QTcpSocket *>(sender());
+	QHash<QTcpSocket *, Subscriber>::iterator it = subscribers.find(socket);
+	if (it != subscribers.end()) {
+		flush(socket, it.value());
+	}
+}
+
+void EventStream::discardInput() {
+	QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+	if (socket) {
+		socket->readAll();
+	}
+}
+
+void EventStream::disconnected() {
+	QTcpSocket *socket = static_cast<QTcpSocket *>(sender());
+	if (subscribers.remove(socket)) {
+		channel->subscriberCount.deref();
+#ifdef CMAKE_DEBUG
+		qDebug("EventStream (%p): subscriber disconnected", static_cast<void *>(this));
+#endif
+	}
+	socket->deleteLater();
+	if (subscribers.isEmpty()) {
+		heartbeatTimer->stop();
+	}
+}
+
+void EventStream::heartbeat() {
+	// A comment line is ignored by the client, it only keeps the connection alive
+	for (QHash<QTcpSocket *, Subscriber>::iterator it = subscribers.begin(); it != subscribers.end(); ++it) {
+		Subscriber &subscriber = it.value();
+		if (!subscriber.active && subscriber.queue.isEmpty()) {
+			it.key()->write(":\n\n");
+		}
+		subscriber.active = false;
+	}
+	int interval = channel->heartbeatInterval.loadAcquire();
+	if (interval > 0) {
+		heartbeatTimer->start(interval);
+	} else {
+		heartbeatTimer->stop();
+	}
+}
+
+void EventStream::closeSubscribers() {
+	// Closing a connection may remove its subscriber immediately
+	foreach (QTcpSocket *socket, subscribers.keys()) {
+		QHash<QTcpSocket *, Subscriber>::iterator it = subscribers.find(socket);
+		if (it == subscribers.end()) {
+			continue;
+		}
+		foreach (const QByteArray &event, it.value().queue) {
+			socket->write(event);
+		}
+		it.value().queue.clear();
+		socket->disconnectFromHost();
+	}
+}
+
+void EventStream::threadDone() {
+	channel->removeStream(QThread::currentThread());
+	delete this;
+}
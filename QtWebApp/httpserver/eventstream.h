@@ -0,0 +1,84 @@
+#pragma once
+
+#include "qtwebappglobal.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QTcpSocket>
+#include <QTimer>
+
+namespace qtwebapp {
+
+	class EventChannel;
+
+	/**
+	  The subscribers of an EventChannel whose connections are processed by the same thread. Events are
+	  delivered to all of them with a single call in that thread. This class is used internally by
+	  EventChannel.
+	*/
+	class QTWEBAPP_EXPORT EventStream : public QObject {
+		Q_OBJECT
+		Q_DISABLE_COPY(EventStream)
+
+	  public:
+		/**
+		  Constructor.
+		  @param channel The channel that owns this stream
+		*/
+		EventStream(EventChannel *channel);
+
+		/** Destructor, closes the connections of all subscribers */
+		virtual ~EventStream();
+
+	  private:
+		/** A subscribed connection */
+		struct Subscriber {
+			/** Events that have not been passed to the socket yet, they share the buffers of all subscribers */
+			QList<QByteArray> queue;
+
+			/** Whether something has been sent since the last heartbeat */
+			bool active;
+		};
+
+		/** The channel that owns this stream */
+		EventChannel *channel;
+
+		/** The subscribers */
+		QHash<QTcpSocket *, Subscriber> subscribers;
+
+		/** Sends heartbeats to idle subscribers */
+		QTimer *heartbeatTimer;
+
+		/** Pass queued events to the socket, as long as its write buffer is small */
+		void flush(QTcpSocket *socket, Subscriber &subscriber);
+
+	  private slots:
+
+		/** Add a subscriber, its socket has already been moved to this thread */
+		void addSubscriber(QTcpSocket *socket);
+
+		/** Queue a serialized event for all subscribers */
+		void deliver(const QByteArray &event);
+
+		/** Received from a socket when it has sent data */
+		void bytesWritten();
+
+		/** Received from a socket when the client sent data, which is ignored */
+		void discardInput();
+
+		/** Received from a socket when the connection has been closed */
+		void disconnected();
+
+		/** Received from the heartbeat timer */
+		void heartbeat();
+
+		/** Close all connections when the thread finishes */
+		void threadDone();
+
+		/** Send the queued events and close all connections, when the server shuts down */
+		void closeSubscribers();
+	};
+
+} // namespace qtwebapp
@@ -0,0 +1,754 @@
+#include "http2connection.h"
+
+#include "httpresponse.h"
+
+using namespace qtwebapp;
+
+const char Http2Connection::preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+/** Length of the connection preface */
+static const int prefaceSize = 24;
+
+/** Frame types */
+enum FrameType {
+	dataFrame = 0x0,
+	headersFrame = 0x1,
+	priorityFrame = 0x2,
+	rstStreamFrame = 0x3,
+	settingsFrame = 0x4,
+	pushPromiseFrame = 0x5,
+	pingFrame = 0x6,
+	goAwayFrame = 0x7,
+	windowUpdateFrame = 0x8,
+	continuationFrame = 0x9
+};
+
+/** Frame flags */
+static const quint8 flagEndStream = 0x1;
+static const quint8 flagAck = 0x1;
+static const quint8 flagEndHeaders = 0x4;
+static const quint8 flagPadded = 0x8;
+static const quint8 flagPriority = 0x20;
+
+/** Settings */
+static const quint16 settingHeaderTableSize = 0x1;
+static const quint16 settingEnablePush = 0x2;
+static const quint16 settingMaxConcurrentStreams = 0x3;
+static const quint16 settingInitialWindowSize = 0x4;
+static const quint16 settingMaxFrameSize = 0x5;
+static const quint16 settingMaxHeaderListSize = 0x6;
+
+/** Initial flow control window of the connection and of each stream */
+static const qint32 defaultWindowSize = 65535;
+
+/** Maximum size of received frames, which is the default of HTTP/2 */
+static const int maxReceiveFrameSize = 16384;
+
+/** Maximum size of the dynamic table for received header blocks, which is the default of HTTP/2 */
+static const int headerTableSize = 4096;
+
+static quint32 readUInt32(const char *data) {
+	const uchar *bytes = reinterpret_cast<const uchar *>(data);
+	return (quint32(bytes[0]) << 24) | (quint32(bytes[1]) << 16) | (quint32(bytes[2]) << 8) | quint32(bytes[3]);
+}
+
+static void writeUInt32(char *data, quint32 value) {
+	data[0] = char(value >> 24);
+	data[1] = char(value >> 16);
+	data[2] = char(value >> 8);
+	data[3] = char(value);
+}
+
+static void writeSetting(char *data, quint16 id, quint32 value) {
+	data[0] = char(id >> 8);
+	data[1] = char(id);
+	writeUInt32(data + 2, value);
+}
+
+Http2Connection::Http2Connection(QTcpSocket *socket, const HttpServerConfig &cfg, HttpRequestHandler *requestHandler,
+                                 HttpClientLimiter *clientLimiter, HttpServerStatistics *statistics)
+    : socket(socket), cfg(cfg), requestHandler(requestHandler), clientLimiter(clientLimiter), statistics(statistics),
+      decoder(headerTableSize, cfg.maxRequestSize) {
+	prefaceReceived = false;
+	currentStream = nullptr;
+	lastStreamId = 0;
+	headerStreamId = 0;
+	headerEndStream = false;
+	headerNewStream = false;
+	sendWindow = defaultWindowSize;
+	receiveWindow = defaultWindowSize;
+	initialSendWindow = defaultWindowSize;
+	maxSendFrameSize = maxReceiveFrameSize;
+	dispatching = false;
+	goAwayReceived = false;
+	closed = false;
+	draining = false;
+	drainStreamId = 0;
+
+	// The server starts the connection with its settings
+	char settings[12];
+	writeSetting(settings, settingMaxConcurrentStreams, quint32(cfg.http2MaxConcurrentStreams));
+	writeSetting(settings + 6, settingMaxHeaderListSize, quint32(cfg.maxRequestSize));
+	writeFrame(settingsFrame, 0, 0, settings, sizeof(settings));
+	socket->flush();
+#ifdef CMAKE_DEBUG
+	qDebug("Http2Connection (%p): constructed", static_cast<void *>(this));
+#endif
+}
+
+Http2Connection::~Http2Connection() {
+	foreach (Stream *stream, streams) {
+		delete stream->request;
+		delete stream;
+	}
+#ifdef CMAKE_DEBUG
+	qDebug("Http2Connection (%p): destroyed", static_cast<void *>(this));
+#endif
+}
+
+QTcpSocket *Http2Connection::getSocket() const {
+	return socket;
+}
+
+void Http2Connection::read() {
+	receiveFrames();
+	// While a request is serviced, this is called only to receive frames
+	if (!dispatching) {
+		dispatch();
+	}
+	socket->flush();
+}
+
+void Http2Connection::goAway(ErrorCode error) {
+	if (closed) {
+		return;
+	}
+	closed = true;
+	if (socket->state() != QAbstractSocket::ConnectedState) {
+		return;
+	}
+#ifdef CMAKE_DEBUG
+	qDebug("Http2Connection (%p): sending GOAWAY with error code %i", static_cast<void *>(this), error);
+#endif
+	// The last stream id must not increase after drain()
+	if (!draining || error != noError) {
+		char payload[8];
+		writeUInt32(payload, draining ? drainStreamId : lastStreamId);
+		writeUInt32(payload + 4, quint32(error));
+		writeFrame(goAwayFrame, 0, 0, payload, sizeof(payload));
+	}
+	while (socket->bytesToWrite()) {
+		if (!socket->waitForBytesWritten(cfg.writeTimeout)) {
+			socket->abort();
+			return;
+		}
+	}
+	socket->disconnectFromHost();
+}
+
+void Http2Connection::drain() {
+	if (closed || draining) {
+		return;
+	}
+	draining = true;
+	drainStreamId = lastStreamId;
+	if (socket->state() != QAbstractSocket::ConnectedState) {
+		return;
+	}
+#ifdef CMAKE_DEBUG
+	qDebug("Http2Connection (%p): draining after stream %u", static_cast<void *>(this), drainStreamId);
+#endif
+	char payload[8];
+	writeUInt32(payload, drainStreamId);
+	writeUInt32(payload + 4, quint32(noError));
+	writeFrame(goAwayFrame, 0, 0, payload, sizeof(payload));
+	socket->flush();
+	// Otherwise dispatch() closes the connection after the last stream
+	if (!dispatching && streams.isEmpty()) {
+		goAway();
+	}
+}
+
+void Http2Connection::connectionError(ErrorCode error, const char *reason) {
+	qWarning("Http2Connection (%p): %s", static_cast<void *>(this), reason);
+	goAway(error);
+}
+
+void Http2Connection::receiveFrames() {
+	if (closed) {
+		return;
+	}
+	inputBuffer.append(socket->readAll());
+	int pos = 0;
+	if (!prefaceReceived) {
+		if (inputBuffer.size() < prefaceSize) {
+			return;
+		}
+		if (!inputBuffer.startsWith(preface)) {
+			connectionError(protocolError, "invalid connection preface");
+			return;
+		}
+		prefaceReceived = true;
+		pos = prefaceSize;
+	}
+
+	// Each frame starts with 9 bytes: length (24 bit), type, flags and stream id (31 bit)
+	while (!closed && inputBuffer.size() - pos >= 9) {
+		const char *header = inputBuffer.constData() + pos;
+		int length = (int(uchar(header[0])) << 16) | (int(uchar(header[1])) << 8) | int(uchar(header[2]));
+		quint8 type = quint8(header[3]);
+		quint8 flags = quint8(header[4]);
+		quint32 streamId = readUInt32(header + 5) & 0x7fffffff;
+		if (length > maxReceiveFrameSize) {
+			connectionError(frameSizeError, "received frame is too large");
+			return;
+		}
+		if (inputBuffer.size() - pos - 9 < length) {
+			break;
+		}
+#ifdef SUPERVERBOSE
+		qDebug("Http2Connection (%p): received frame type %i, flags %i, stream %u, %i bytes",
+		       static_cast<void *>(this), type, flags, streamId, length);
+#endif
+		QByteArray payload = inputBuffer.mid(pos + 9, length);
+		pos += 9 + length;
+		processFrame(type, flags, streamId, payload);
+	}
+	inputBuffer.remove(0, pos);
+}
+
+void Http2Connection::processFrame(quint8 type, quint8 flags, quint32 streamId, const QByteArray &payload) {
+	// A header block must not be interrupted by other frames
+	if (headerStreamId != 0 && (type != continuationFrame || streamId != headerStreamId)) {
+		connectionError(protocolError, "expected CONTINUATION frame");
+		return;
+	}
+
+	switch (type) {
+		case dataFrame:
+			processData(flags, streamId, payload);
+			break;
+
+		case headersFrame: {
+			if (streamId == 0 || (streamId & 1) == 0) {
+				connectionError(protocolError, "invalid stream id of HEADERS frame");
+				return;
+			}
+			int start = 0;
+			int padding = 0;
+			if (flags & flagPadded) {
+				if (payload.isEmpty()) {
+					connectionError(protocolError, "HEADERS frame is too short");
+					return;
+				}
+				padding = uchar(payload.at(0));
+				start = 1;
+			}
+			if (flags & flagPriority) {
+				// Priorities are ignored, requests are serviced in the order of completion
+				start += 5;
+			}
+			if (start + padding > payload.size()) {
+				connectionError(protocolError, "invalid padding of HEADERS frame");
+				return;
+			}
+			headerBlock = payload.mid(start, payload.size() - start - padding);
+			headerStreamId = streamId;
+			headerEndStream = (flags & flagEndStream) != 0;
+			headerNewStream = streamId > lastStreamId;
+			if (headerNewStream) {
+				lastStreamId = streamId;
+			}
+			if (flags & flagEndHeaders) {
+				processHeaderBlock();
+			}
+			break;
+		}
+
+		case continuationFrame:
+			if (headerStreamId == 0) {
+				connectionError(protocolError, "unexpected CONTINUATION frame");
+				return;
+			}
+			headerBlock.append(payload);
+			if (headerBlock.size() > cfg.maxRequestSize) {
+				connectionError(enhanceYourCalm, "header block is too large");
+				return;
+			}
+			if (flags & flagEndHeaders) {
+				processHeaderBlock();
+			}
+			break;
+
+		case priorityFrame:
+			if (streamId == 0) {
+				connectionError(protocolError, "PRIORITY frame without stream");
+			} else if (payload.size() != 5) {
+				resetStream(streamId, frameSizeError);
+			}
+			break;
+
+		case rstStreamFrame:
+			if (streamId == 0 || streamId > lastStreamId) {
+				connectionError(protocolError, "RST_STREAM frame on idle stream");
+			} else if (payload.size() != 4) {
+				connectionError(frameSizeError, "invalid RST_STREAM frame");
+			} else if (streams.contains(streamId)) {
+#ifdef CMAKE_DEBUG
+				qDebug("Http2Connection (%p): stream %u has been reset", static_cast<void *>(this), streamId);
+#endif
+				removeStream(streams.value(streamId));
+			}
+			break;
+
+		case settingsFrame:
+			processSettings(flags, streamId, payload);
+			break;
+
+		case pushPromiseFrame:
+			connectionError(protocolError, "client sent PUSH_PROMISE frame");
+			break;
+
+		case pingFrame:
+			if (streamId != 0) {
+				connectionError(protocolError, "PING frame on a stream");
+			} else if (payload.size() != 8) {
+				connectionError(frameSizeError, "invalid PING frame");
+			} else if ((flags & flagAck) == 0) {
+				writeFrame(pingFrame, flagAck, 0, payload.constData(), payload.size());
+			}
+			break;
+
+		case goAwayFrame:
+			if (streamId != 0) {
+				connectionError(protocolError, "GOAWAY frame on a stream");
+			} else {
+				goAwayReceived = true;
+			}
+			break;
+
+		case windowUpdateFrame:
+			processWindowUpdate(streamId, payload);
+			break;
+
+		default:
+			// Unknown frame types must be ignored
+			break;
+	}
+}
+
+void Http2Connection::processHeaderBlock() {
+	quint32 streamId = headerStreamId;
+	headerStreamId = 0;
+	QList<Http2Header> fields;
+	// The block must be decoded in any case, otherwise the dynamic table gets out of sync
+	bool decoded = decoder.decode(headerBlock, fields);
+	headerBlock.clear();
+	if (!decoded) {
+		connectionError(compressionError, "cannot decode header block");
+		return;
+	}
+
+	if (!headerNewStream) {
+		// Trailers of a request, they must end the stream and are ignored
+		Stream *stream = streams.value(streamId);
+		if (stream == nullptr) {
+			// The block has been decoded above, so the connection can continue (RFC 7540 section 5.1)
+			resetStream(streamId, streamClosed);
+			return;
+		}
+		if (stream->endStreamReceived || !headerEndStream) {
+			resetStream(streamId, protocolError);
+			return;
+		}
+		stream->endStreamReceived = true;
+		stream->request->readFromStream(QByteArray(), true);
+		checkRequest(stream);
+		return;
+	}
+
+	// After drain(), the client may retry the request on a new connection
+	if (draining && streamId > drainStreamId) {
+		resetStream(streamId, refusedStream);
+		return;
+	}
+	if (streams.size() >= cfg.http2MaxConcurrentStreams) {
+		qWarning("Http2Connection (%p): too many concurrent streams", static_cast<void *>(this));
+		resetStream(streamId, refusedStream);
+		return;
+	}
+	Stream *stream = new Stream;
+	stream->id = streamId;
+	stream->request = new HttpRequest(cfg);
+	stream->sendWindow = initialSendWindow;
+	stream->receiveWindow = defaultWindowSize;
+	stream->endStreamReceived = headerEndStream;
+	streams.insert(streamId, stream);
+	if (!stream->request->readStreamHeaders(fields, headerEndStream, socket->peerAddress())) {
+		qWarning("Http2Connection (%p): received malformed request on stream %u", static_cast<void *>(this), streamId);
+		resetStream(streamId, protocolError);
+		return;
+	}
+	checkRequest(stream);
+}
+
+void Http2Connection::processData(quint8 flags, quint32 streamId, const QByteArray &payload) {
+	if (streamId == 0) {
+		connectionError(protocolError, "DATA frame without stream");
+		return;
+	}
+
+	// Flow control applies to the whole frame, including padding. Bodies are limited by maxRequestSize and
+	// maxMultipartSize, so the credit is granted again right away.
+	receiveWindow -= payload.size();
+	if (receiveWindow < 0) {
+		connectionError(flowControlError, "flow control window of the connection exceeded");
+		return;
+	}
+	if (receiveWindow < defaultWindowSize / 2) {
+		sendWindowUpdate(0, quint32(defaultWindowSize - receiveWindow));
+		receiveWindow = defaultWindowSize;
+	}
+
+	int start = 0;
+	int padding = 0;
+	if (flags & flagPadded) {
+		if (payload.isEmpty()) {
+			connectionError(protocolError, "DATA frame is too short");
+			return;
+		}
+		padding = uchar(payload.at(0));
+		start = 1;
+	}
+	if (start + padding > payload.size()) {
+		connectionError(protocolError, "invalid padding of DATA frame");
+		return;
+	}
+
+	Stream *stream = streams.value(streamId);
+	if (stream == nullptr) {
+		if (streamId > lastStreamId) {
+			connectionError(protocolError, "DATA frame on idle stream");
+		}
+		// Otherwise the stream has been closed already, and the data is discarded
+		return;
+	}
+	if (stream->endStreamReceived) {
+		resetStream(streamId, streamClosed);
+		return;
+	}
+	stream->receiveWindow -= payload.size();
+	if (stream->receiveWindow < 0) {
+		resetStream(streamId, flowControlError);
+		return;
+	}
+	bool endStream = (flags & flagEndStream) != 0;
+	if (!endStream && stream->receiveWindow < defaultWindowSize / 2) {
+		sendWindowUpdate(streamId, quint32(defaultWindowSize - stream->receiveWindow));
+		stream->receiveWindow = defaultWindowSize;
+	}
+	stream->endStreamReceived = endStream;
+	stream->request->readFromStream(payload.mid(start, payload.size() - start - padding), endStream);
+	checkRequest(stream);
+}
+
+void Http2Connection::processSettings(quint8 flags, quint32 streamId, const QByteArray &payload) {
+	if (streamId != 0) {
+		connectionError(protocolError, "SETTINGS frame on a stream");
+		return;
+	}
+	if (flags & flagAck) {
+		if (!payload.isEmpty()) {
+			connectionError(frameSizeError, "invalid SETTINGS acknowledgement");
+		}
+		return;
+	}
+	if (payload.size() % 6 != 0) {
+		connectionError(frameSizeError, "invalid SETTINGS frame");
+		return;
+	}
+	for (int i = 0; i < payload.size(); i += 6) {
+		quint16 id = quint16((uchar(payload.at(i)) << 8) | uchar(payload.at(i + 1)));
+		quint32 value = readUInt32(payload.constData() + i + 2);
+		switch (id) {
+			case settingHeaderTableSize:
+				encoder.setMaxTableSize(value);
+				break;
+			case settingEnablePush:
+				if (value > 1) {
+					connectionError(protocolError, "invalid value of SETTINGS_ENABLE_PUSH");
+					return;
+				}
+				break;
+			case settingInitialWindowSize:
+				if (value > 0x7fffffff) {
+					connectionError(flowControlError, "invalid value of SETTINGS_INITIAL_WINDOW_SIZE");
+					return;
+				}
+				// The difference applies to all open streams
+				foreach (Stream *stream, streams) {
+					stream->sendWindow += qint64(value) - initialSendWindow;
+				}
+				initialSendWindow = value;
+				break;
+			case settingMaxFrameSize:
+				if (value < 16384 || value > 16777215) {
+					connectionError(protocolError, "invalid value of SETTINGS_MAX_FRAME_SIZE");
+					return;
+				}
+				maxSendFrameSize = int(value);
+				break;
+			default:
+				// Unknown settings and settings that are meaningless for a server are ignored
+				break;
+		}
+	}
+	writeFrame(settingsFrame, flagAck, 0);
+}
+
+void Http2Connection::processWindowUpdate(quint32 streamId, const QByteArray &payload) {
+	if (payload.size() != 4) {
+		connectionError(frameSizeError, "invalid WINDOW_UPDATE frame");
+		return;
+	}
+	quint32 increment = readUInt32(payload.constData()) & 0x7fffffff;
+	if (streamId == 0) {
+		if (increment == 0) {
+			connectionError(protocolError, "WINDOW_UPDATE without increment");
+			return;
+		}
+		sendWindow += increment;
+		if (sendWindow > 0x7fffffff) {
+			connectionError(flowControlError, "flow control window of the connection is too large");
+		}
+		return;
+	}
+	Stream *stream = streams.value(streamId);
+	if (stream == nullptr) {
+		if (streamId > lastStreamId) {
+			connectionError(protocolError, "WINDOW_UPDATE frame on idle stream");
+		}
+		return;
+	}
+	if (increment == 0) {
+		resetStream(streamId, protocolError);
+		return;
+	}
+	stream->sendWindow += increment;
+	if (stream->sendWindow > 0x7fffffff) {
+		resetStream(streamId, flowControlError);
+	}
+}
+
+void Http2Connection::checkRequest(Stream *stream) {
+	HttpRequest::RequestStatus status = stream->request->getStatus();
+	if (status == HttpRequest::abort) {
+		rejectStream(stream);
+	} else if (status == HttpRequest::complete) {
+		completeStreams.append(stream->id);
+	}
+}
+
+void Http2Connection::dispatch() {
+	dispatching = true;
+	while (!closed && !completeStreams.isEmpty() && socket->state() == QAbstractSocket::ConnectedState) {
+		Stream *stream = streams.value(completeStreams.takeFirst());
+		Q_ASSERT(stream != nullptr);
+		currentStream = stream;
+		service(stream);
+		currentStream = nullptr;
+		// The stream may have been removed already, if the client has reset it
+		if (streams.value(stream->id) == stream) {
+			streams.remove(stream->id);
+		}
+		delete stream->request;
+		delete stream;
+	}
+	dispatching = false;
+
+	// After GOAWAY from the client or drain(), the connection is closed when the last stream has been answered
+	if ((goAwayReceived || draining) && streams.isEmpty()) {
+		goAway();
+	}
+}
+
+void Http2Connection::service(Stream *stream) {
+#ifdef CMAKE_DEBUG
+	qDebug("Http2Connection (%p): received request on stream %u", static_cast<void *>(this), stream->id);
+#endif
+	// Reject the request if the client has exceeded its request rate, the connection stays open
+	if (clientLimiter && !clientLimiter->takeRequestToken(socket->peerAddress())) {
+		HttpResponse response(this, stream->id, cfg);
+		response.setStatus(429);
+		response.setHeader("Retry-After", QByteArray::number(cfg.retryAfter));
+		response.write("429 too many requests", true);
+		return;
+	}
+
+	// Let the request handler reject the request, like it can do for HTTP/1.x before the body is transferred
+	{
+		HttpResponse response(this, stream->id, cfg);
+		bool accepted = false;
+		try {
+			accepted = requestHandler->acceptRequest(*stream->request, response);
+		} catch (...) {
+			qCritical("Http2Connection (%p): An uncatched exception occured in the request handler",
+			          static_cast<void *>(this));
+		}
+		if (!accepted) {
+			if (!response.hasSentLastPart()) {
+				if (response.getStatusCode() == 200) {
+					response.setStatus(403);
+					response.write("403 forbidden", true);
+				} else {
+					response.write(QByteArray(), true);
+				}
+			}
+			return;
+		}
+	}
+
+	HttpResponse response(this, stream->id, cfg);
+	try {
+		requestHandler->service(*stream->request, response);
+	} catch (...) {
+		qCritical("Http2Connection (%p): An uncatched exception occured in the request handler",
+		          static_cast<void *>(this));
+	}
+	if (!response.hasSentLastPart()) {
+		response.write(QByteArray(), true);
+	}
+#ifdef CMAKE_DEBUG
+	qDebug("Http2Connection (%p): finished request on stream %u", static_cast<void *>(this), stream->id);
+#endif
+}
+
+void Http2Connection::rejectStream(Stream *stream) {
+	QList<Http2Header> headers;
+	headers.append(Http2Header(":status", stream->request->headerTooLarge ? "431" : "413"));
+	sendHeaders(stream->id, headers, true);
+	if (stream->endStreamReceived) {
+		removeStream(stream);
+	} else {
+		// Tell the client to stop sending the body
+		resetStream(stream->id, noError);
+	}
+}
+
+void Http2Connection::resetStream(quint32 streamId, ErrorCode error) {
+	char payload[4];
+	writeUInt32(payload, quint32(error));
+	writeFrame(rstStreamFrame, 0, streamId, payload, sizeof(payload));
+	Stream *stream = streams.value(streamId);
+	if (stream != nullptr) {
+		removeStream(stream);
+	}
+}
+
+void Http2Connection::removeStream(Stream *stream) {
+	streams.remove(stream->id);
+	completeStreams.removeAll(stream->id);
+	if (stream != currentStream) {
+		delete stream->request;
+		delete stream;
+	}
+}
+
+bool Http2Connection::sendHeaders(quint32 streamId, const QList<Http2Header> &headers, bool endStream) {
+	if (closed || !streams.contains(streamId)) {
+		return false;
+	}
+	QByteArray block;
+	encoder.encode(headers, block);
+
+	// Large header blocks are split into a HEADERS frame and CONTINUATION frames
+	int offset = 0;
+	quint8 type = headersFrame;
+	quint8 flags = endStream ? flagEndStream : 0;
+	do {
+		int size = qMin(block.size() - offset, maxSendFrameSize);
+		if (offset + size == block.size()) {
+			flags |= flagEndHeaders;
+		}
+		if (!writeFrame(type, flags, streamId, block.constData() + offset, size)) {
+			return false;
+		}
+		offset += size;
+		type = continuationFrame;
+		flags = 0;
+	} while (offset < block.size());
+	return true;
+}
+
+bool Http2Connection::sendData(quint32 streamId, const QByteArray &data, bool endStream) {
+	if (data.isEmpty() && !endStream) {
+		return true;
+	}
+	int offset = 0;
+	do {
+		Stream *stream = streams.value(streamId);
+		if (closed || stream == nullptr || socket->state() != QAbstractSocket::ConnectedState) {
+			return false;
+		}
+		qint64 window = qMin(sendWindow, stream->sendWindow);
+		int size = int(qMax(qint64(0), qMin(qint64(qMin(data.size() - offset, maxSendFrameSize)), window)));
+		if (size == 0 && offset < data.size()) {
+			// Wait until the client grants more flow control credit, meanwhile frames of other streams are received
+			socket->flush();
+			if (!socket->waitForReadyRead(cfg.readTimeout)) {
+				qWarning("Http2Connection (%p): timeout while waiting for flow control credit", static_cast<void *>(this));
+				goAway();
+				return false;
+			}
+			receiveFrames();
+			continue;
+		}
+		bool last = offset + size == data.size();
+		if (!writeFrame(dataFrame, last && endStream ? flagEndStream : 0, streamId, data.constData() + offset, size)) {
+			return false;
+		}
+		sendWindow -= size;
+		stream->sendWindow -= size;
+		offset += size;
+	} while (offset < data.size());
+	return true;
+}
+
+void Http2Connection::sendWindowUpdate(quint32 streamId, quint32 increment) {
+	char payload[4];
+	writeUInt32(payload, increment);
+	writeFrame(windowUpdateFrame, 0, streamId, payload, sizeof(payload));
+}
+
+bool Http2Connection::writeFrame(quint8 type, quint8 flags, quint32 streamId, const char *payload, int size) {
+	char header[9];
+	header[0] = char(size >> 16);
+	header[1] = char(size >> 8);
+	header[2] = char(size);
+	header[3] = char(type);
+	header[4] = char(flags);
+	writeUInt32(header + 5, streamId);
+	return writeToSocket(header, sizeof(header)) && writeToSocket(payload, size);
+}
+
+bool Http2Connection::writeToSocket(const char *data, int size) {
+	while (socket->isOpen() && size > 0) {
+		// If the output buffer has become large, then wait until it has been sent.
+		if (socket->bytesToWrite() > 16384) {
+			if (!socket->waitForBytesWritten(cfg.writeTimeout) && socket->bytesToWrite() > 16384) {
+				qWarning("Http2Connection (%p): write timeout, closing the connection", static_cast<void *>(this));
+				closed = true;
+				socket->abort();
+				return false;
+			}
+		}
+
+		qint64 written = socket->write(data, size);
+		if (written == -1) {
+			return false;
+		}
+		data += written;
+		size -= int(written);
+	}
+	return size == 0;
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include "http2hpack.h"
+#include "httpclientlimiter.h"
+#include "httprequest.h"
+#include "httprequesthandler.h"
+#include "httpserverconfig.h"
+#include "httpserverstatistics.h"
+#include "qtwebappglobal.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QTcpSocket>
+
+namespace qtwebapp {
+
+	/**
+	  Server side of a HTTP/2 connection (RFC 7540). The connection handler switches to HTTP/2 if the
+	  client starts with the connection preface (h2c with prior knowledge, e.g. curl --http2-prior-knowledge)
+	  or negotiates h2 with ALPN during the TLS handshake.
+	  <p>
+	  Each stream is mapped to a HttpRequest and a HttpResponse, so request handlers work with HTTP/2
+	  exactly like with HTTP/1.x. Streams are received in parallel, but serviced one after the other in the
+	  thread of the connection handler, in the order in which their requests have been completed. While a
+	  response waits for flow control credit, frames of other streams are still received.
+	  <p>
+	  Request bodies are always collected before the request handler is called, streamed bodies are not
+	  supported with HTTP/2.
+	  <p>
+	  Example for the configuration settings:
+	  <code><pre>
+	  http2=true
+	  http2MaxConcurrentStreams=100
+	  </pre></code>
+	*/
+	class QTWEBAPP_EXPORT Http2Connection {
+		Q_DISABLE_COPY(Http2Connection)
+		friend class HttpResponse;
+
+	  public:
+		/** Error codes of RST_STREAM and GOAWAY frames */
+		enum ErrorCode {
+			noError = 0x0,
+			protocolError = 0x1,
+			internalError = 0x2,
+			flowControlError = 0x3,
+			streamClosed = 0x5,
+			frameSizeError = 0x6,
+			refusedStream = 0x7,
+			cancel = 0x8,
+			compressionError = 0x9,
+			enhanceYourCalm = 0xb
+		};
+
+		/** The connection preface that a HTTP/2 client sends first */
+		static const char preface[];
+
+		/**
+		  Constructor, sends the SETTINGS frame of the server.
+		  @param socket The connection, after the protocol has been detected
+		  @param cfg Configuration of the HTTP server
+		  @param requestHandler Handler that will process each request
+		  @param clientLimiter Limits the request rate of the client, may be NULL
+		  @param statistics Counters that are updated by the responses, may be NULL
+		*/
+		Http2Connection(QTcpSocket *socket, const HttpServerConfig &cfg, HttpRequestHandler *requestHandler,
+		                HttpClientLimiter *clientLimiter = nullptr, HttpServerStatistics *statistics = nullptr);
+
+		/** Destructor, deletes the requests of all open streams */
+		virtual ~Http2Connection();
+
+		/** Process the received frames and service all completed requests. Called when the socket has data to read. */
+		void read();
+
+		/** Send a GOAWAY frame and close the connection, e.g. after a timeout. */
+		void goAway(ErrorCode error = noError);
+
+		/**
+		  Send a GOAWAY frame when the server shuts down gracefully. The streams that the client has opened
+		  already are still received and serviced, new streams are refused. The connection is closed after
+		  the last of them has been answered.
+		*/
+		void drain();
+
+		/** Get the socket of the connection */
+		QTcpSocket *getSocket() const;
+
+	  private:
+		/** A stream that has been opened by a HEADERS frame */
+		struct Stream {
+			/** Identifier of the stream */
+			quint32 id;
+
+			/** The request, created from the header block */
+			HttpRequest *request;
+
+			/** Flow control window for sending data */
+			qint64 sendWindow;
+
+			/** Flow control window for receiving data */
+			qint32 receiveWindow;
+
+			/** Whether the client has sent the end of the stream */
+			bool endStreamReceived;
+		};
+
+		/** The connection */
+		QTcpSocket *socket;
+
+		/** Configuration */
+		HttpServerConfig cfg;
+
+		/** Dispatches received requests to services */
+		HttpRequestHandler *requestHandler;
+
+		/** Limits the request rate of the client, or nullptr */
+		HttpClientLimiter *clientLimiter;
+
+		/** Counters that are updated by the responses, or nullptr */
+		HttpServerStatistics *statistics;
+
+		/** Decoder for the header blocks of the client */
+		HpackDecoder decoder;
+
+		/** Encoder for the header blocks of the responses */
+		HpackEncoder encoder;
+
+		/** Received data that does not form a complete frame yet */
+		QByteArray inputBuffer;
+
+		/** Whether the connection preface has been received */
+		bool prefaceReceived;
+
+		/** Open streams, key is the stream id */
+		QHash<quint32, Stream *> streams;
+
+		/** Streams with a complete request, in the order of completion */
+		QList<quint32> completeStreams;
+
+		/** The stream that is currently serviced, or nullptr */
+		Stream *currentStream;
+
+		/** Highest stream id opened by the client */
+		quint32 lastStreamId;
+
+		/** Stream of the header block that is continued by CONTINUATION frames, or 0 */
+		quint32 headerStreamId;
+
+		/** Header block collected from HEADERS and CONTINUATION frames */
+		QByteArray headerBlock;
+
+		/** Whether the HEADERS frame of the current header block ends the stream */
+		bool headerEndStream;
+
+		/** Whether the current header block opens a new stream */
+		bool headerNewStream;
+
+		/** Flow control window of the connection for sending data */
+		qint64 sendWindow;
+
+		/** Flow control window of the connection for receiving data */
+		qint32 receiveWindow;
+
+		/** Initial flow control window of new streams for sending data, as announced by the client */
+		qint64 initialSendWindow;
+
+		/** Maximum size of frames that the client accepts */
+		int maxSendFrameSize;
+
+		/** Whether a request is serviced at the moment */
+		bool dispatching;
+
+		/** Whether the client sent GOAWAY */
+		bool goAwayReceived;
+
+		/** Whether the connection is closed after GOAWAY has been sent */
+		bool closed;
+
+		/** Whether GOAWAY has been sent by drain(), while the open streams are finished */
+		bool draining;
+
+		/** The last stream id announced by drain(), higher streams are refused */
+		quint32 drainStreamId;
+
+		/** Parse and process all complete frames that have been received. */
+		void receiveFrames();
+
+		/** Process a single frame. */
+		void processFrame(quint8 type, quint8 flags, quint32 streamId, const QByteArray &payload);
+
+		/** Process the header block, after all CONTINUATION frames have been received. */
+		void processHeaderBlock();
+
+		/** Process a DATA frame */
+		void processData(quint8 flags, quint32 streamId, const QByteArray &payload);
+
+		/** Process a SETTINGS frame */
+		void processSettings(quint8 flags, quint32 streamId, const QByteArray &payload);
+
+		/** Process a WINDOW_UPDATE frame */
+		void processWindowUpdate(quint32 streamId, const QByteArray &payload);
+
+		/** Queue the stream for servicing or reject it, depending on the status of its request. */
+		void checkRequest(Stream *stream);
+
+		/** Service all complete requests, one after the other. */
+		void dispatch();
+
+		/** Service the request of a stream */
+		void service(Stream *stream);
+
+		/**
+		  Answer a request that is too large with status 413, or 431 if it has too many headers, without waiting
+		  for flow control credit.
+		  The stream is reset if the client has not finished sending it.
+		*/
+		void rejectStream(Stream *stream);
+
+		/** Send RST_STREAM and remove the stream, if it is open */
+		void resetStream(quint32 streamId, ErrorCode error);
+
+		/** Remove a stream and delete its request. The stream that is serviced at the moment is deleted later. */
+		void removeStream(Stream *stream);
+
+		/** Close the connection because of a protocol violation of the client */
+		void connectionError(ErrorCode error, const char *reason);
+
+		/**
+		  Send the response headers of a stream, used by HttpResponse.
+		  @return False if the stream has been reset or the connection has been closed
+		*/
+		bool sendHeaders(quint32 streamId, const QList<Http2Header> &headers, bool endStream);
+
+		/**
+		  Send response body data of a stream, used by HttpResponse. Blocks while waiting for flow control credit.
+		  @return False if the stream has been reset or the connection has been closed
+		*/
+		bool sendData(quint32 streamId, const QByteArray &data, bool endStream);
+
+		/** Send a WINDOW_UPDATE frame */
+		void sendWindowUpdate(quint32 streamId, quint32 increment);
+
+		/** Send a frame. This method blocks until all bytes have been passed to the TCP buffer */
+		bool writeFrame(quint8 type, quint8 flags, quint32 streamId, const char *payload = nullptr, int size = 0);
+
+		/** Write raw data to the socket. This method blocks until all bytes have been passed to the TCP buffer */
+		bool writeToSocket(const char *data, int size);
+	};
+
+} // namespace qtwebapp
@@ -0,0 +1,472 @@
+#include "http2hpack.h"
+
+using namespace qtwebapp;
+
+/** The static table of HPACK, see RFC 7541 appendix A */
+static const struct {
+	const char *name;
+	const char *value;
+} staticTable[] = {
+	{":authority", ""},
+	{":method", "GET"},
+	{":method", "POST"},
+	{":path", "/"},
+	{":path", "/index.html"},
+	{":scheme", "http"},
+	{":scheme", "https"},
+	{":status", "200"},
+	{":status", "204"},
+	{":status", "206"},
+	{":status", "304"},
+	{":status", "400"},
+	{":status", "404"},
+	{":status", "500"},
+	{"accept-charset", ""},
+	{"accept-encoding", "gzip, deflate"},
+	{"accept-language", ""},
+	{"accept-ranges", ""},
+	{"accept", ""},
+	{"access-control-allow-origin", ""},
+	{"age", ""},
+	{"allow", ""},
+	{"authorization", ""},
+	{"cache-control", ""},
+	{"content-disposition", ""},
+	{"content-encoding", ""},
+	{"content-language", ""},
+	{"content-length", ""},
+	{"content-location", ""},
+	{"content-range", ""},
+	{"content-type", ""},
+	{"cookie", ""},
+	{"date", ""},
+	{"etag", ""},
+	{"expect", ""},
+	{"expires", ""},
+	{"from", ""},
+	{"host", ""},
+	{"if-match", ""},
+	{"if-modified-since", ""},
+	{"if-none-match", ""},
+	{"if-range", ""},
+	{"if-unmodified-since", ""},
+	{"last-modified", ""},
+	{"link", ""},
+	{"location", ""},
+	{"max-forwards", ""},
+	{"proxy-authenticate", ""},
+	{"proxy-authorization", ""},
+	{"range", ""},
+	{"referer", ""},
+	{"refresh", ""},
+	{"retry-after", ""},
+	{"server", ""},
+	{"set-cookie", ""},
+	{"strict-transport-security", ""},
+	{"transfer-encoding", ""},
+	{"user-agent", ""},
+	{"vary", ""},
+	{"via", ""},
+	{"www-authenticate", ""}
+};
+
+/** Huffman codes of the 256 octets and EOS, see RFC 7541 appendix B */
+static const quint32 huffmanCodes[257] = {
+	0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+	0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+	0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+	0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+	0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+	0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+	0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+	0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+	0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+	0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+	0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+	0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+	0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+	0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+	0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+	0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+	0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+	0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+	0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+	0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+	0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+	0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+	0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+	0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+	0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+	0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+	0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+	0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+	0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+	0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+	0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+	0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+	0x3fffffff
+};
+
+/** Lengths of the Huffman codes in bits */
+static const quint8 huffmanCodeLengths[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30
+};
+
+/** Number of entries in the static table */
+static const quint32 staticTableSize = sizeof(staticTable) / sizeof(staticTable[0]);
+
+/** Maximum size of the dynamic table used by the encoder */
+static const int maxEncoderTableSize = 4096;
+
+/** Decoding tree for Huffman codes, built once from the code table */
+struct HuffmanTree {
+	/** Children of the inner nodes, positive values refer to another node, negative values to a symbol */
+	qint16 nodes[256][2];
+
+	HuffmanTree() {
+		memset(nodes, 0, sizeof(nodes));
+		int count = 1;
+		for (int symbol = 0; symbol < 257; ++symbol) {
+			quint32 code = huffmanCodes[symbol];
+			int node = 0;
+			for (int bit = huffmanCodeLengths[symbol] - 1; bit > 0; --bit) {
+				int branch = (code >> bit) & 1;
+				if (nodes[node][branch] == 0) {
+					nodes[node][branch] = qint16(count++);
+				}
+				node = nodes[node][branch];
+			}
+			nodes[node][code & 1] = qint16(-1 - symbol);
+		}
+	}
+};
+
+/** Decode a Huffman encoded string. Returns false if the string contains EOS or invalid padding. */
+static bool huffmanDecode(const uchar *data, int size, QByteArray &result) {
+	static const HuffmanTree tree;
+	result.resize(0);
+	result.reserve(size * 8 / 5);
+	int node = 0;
+	int depth = 0;
+	bool onlyOnes = true;
+	for (int i = 0; i < size; ++i) {
+		for (int bit = 7; bit >= 0; --bit) {
+			int branch = (data[i] >> bit) & 1;
+			int next = tree.nodes[node][branch];
+			if (next < 0) {
+				if (next == -257) {
+					return false; // EOS must not appear in a string
+				}
+				result.append(char(-1 - next));
+				node = 0;
+				depth = 0;
+				onlyOnes = true;
+			} else {
+				node = next;
+				++depth;
+				onlyOnes = onlyOnes && branch;
+			}
+		}
+	}
+	// The padding must be shorter than 8 bits and consist of the most significant bits of EOS
+	return depth < 8 && onlyOnes;
+}
+
+/** Get the length of a string after Huffman encoding */
+static int huffmanLength(const QByteArray &value) {
+	qint64 bits = 0;
+	for (int i = 0; i < value.size(); ++i) {
+		bits += huffmanCodeLengths[uchar(value.at(i))];
+	}
+	return int((bits + 7) / 8);
+}
+
+/** Append a Huffman encoded string */
+static void huffmanEncode(const QByteArray &value, QByteArray &result) {
+	quint64 bits = 0;
+	int count = 0;
+	for (int i = 0; i < value.size(); ++i) {
+		uchar c = uchar(value.at(i));
+		bits = (bits << huffmanCodeLengths[c]) | huffmanCodes[c];
+		count += huffmanCodeLengths[c];
+		while (count >= 8) {
+			count -= 8;
+			result.append(char(bits >> count));
+		}
+	}
+	if (count > 0) {
+		// Pad with the most significant bits of EOS
+		result.append(char((bits << (8 - count)) | (0xff >> count)));
+	}
+}
+
+/** Decode an integer with a prefix of the given number of bits, see RFC 7541 section 5.1 */
+static bool decodeInteger(const uchar *data, int size, int &pos, int prefixBits, quint32 &value) {
+	if (pos >= size) {
+		return false;
+	}
+	quint32 maxPrefix = (1u << prefixBits) - 1;
+	value = data[pos++] & maxPrefix;
+	if (value < maxPrefix) {
+		return true;
+	}
+	for (int shift = 0; pos < size && shift <= 21; shift += 7) {
+		uchar octet = data[pos++];
+		value += quint32(octet & 0x7f) << shift;
+		if ((octet & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Decode a string literal, see RFC 7541 section 5.2 */
+static bool decodeString(const uchar *data, int size, int &pos, QByteArray &value) {
+	if (pos >= size) {
+		return false;
+	}
+	bool huffman = (data[pos] & 0x80) != 0;
+	quint32 length;
+	if (!decodeInteger(data, size, pos, 7, length) || length > quint32(size - pos)) {
+		return false;
+	}
+	if (huffman) {
+		if (!huffmanDecode(data + pos, int(length), value)) {
+			return false;
+		}
+	} else {
+		value = QByteArray(reinterpret_cast<const char *>(data + pos), int(length));
+	}
+	pos += int(length);
+	return true;
+}
+
+/** Append an integer with a prefix of the given number of bits, the other bits of the first octet are in pattern */
+static void encodeInteger(QByteArray &block, uchar pattern, int prefixBits, quint32 value) {
+	quint32 maxPrefix = (1u << prefixBits) - 1;
+	if (value < maxPrefix) {
+		block.append(char(pattern | value));
+		return;
+	}
+	block.append(char(pattern | maxPrefix));
+	value -= maxPrefix;
+	while (value >= 128) {
+		block.append(char((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	block.append(char(value));
+}
+
+/** Append a string literal, Huffman encoded if that is shorter */
+static void encodeString(QByteArray &block, const QByteArray &value) {
+	int length = huffmanLength(value);
+	if (length < value.size()) {
+		encodeInteger(block, 0x80, 7, quint32(length));
+		huffmanEncode(value, block);
+	} else {
+		encodeInteger(block, 0x00, 7, quint32(value.size()));
+		block.append(value);
+	}
+}
+
+HpackTable::HpackTable() {
+	size = 0;
+	maxSize = 4096;
+}
+
+bool HpackTable::lookup(quint32 index, Http2Header &header) const {
+	if (index == 0) {
+		return false;
+	}
+	if (index <= staticTableSize) {
+		header.first = QByteArray::fromRawData(staticTable[index - 1].name, int(qstrlen(staticTable[index - 1].name)));
+		header.second = QByteArray::fromRawData(staticTable[index - 1].value, int(qstrlen(staticTable[index - 1].value)));
+		return true;
+	}
+	index -= staticTableSize + 1;
+	if (index >= quint32(entries.size())) {
+		return false;
+	}
+	header = entries.at(int(index));
+	return true;
+}
+
+quint32 HpackTable::find(const Http2Header &header, quint32 &nameIndex) const {
+	nameIndex = 0;
+	for (quint32 i = 0; i < staticTableSize; ++i) {
+		if (header.first == staticTable[i].name) {
+			if (header.second == staticTable[i].value) {
+				return i + 1;
+			}
+			if (nameIndex == 0) {
+				nameIndex = i + 1;
+			}
+		}
+	}
+	for (int i = 0; i < entries.size(); ++i) {
+		const Http2Header &entry = entries.at(i);
+		if (entry.first == header.first) {
+			if (entry.second == header.second) {
+				return staticTableSize + 1 + quint32(i);
+			}
+			if (nameIndex == 0) {
+				nameIndex = staticTableSize + 1 + quint32(i);
+			}
+		}
+	}
+	return 0;
+}
+
+void HpackTable::insert(const Http2Header &header) {
+	int entrySize = header.first.size() + header.second.size() + 32;
+	if (entrySize > maxSize) {
+		// An entry larger than the table empties the table
+		evict(0);
+		return;
+	}
+	evict(maxSize - entrySize);
+	// Entries of the static table are only referenced, so copy them
+	entries.prepend(Http2Header(QByteArray(header.first.constData(), header.first.size()),
+	                            QByteArray(header.second.constData(), header.second.size())));
+	size += entrySize;
+}
+
+void HpackTable::setMaxSize(int size) {
+	maxSize = size;
+	evict(size);
+}
+
+int HpackTable::getMaxSize() const {
+	return maxSize;
+}
+
+void HpackTable::evict(int limit) {
+	while (size > limit && !entries.isEmpty()) {
+		const Http2Header &entry = entries.last();
+		size -= entry.first.size() + entry.second.size() + 32;
+		entries.removeLast();
+	}
+}
+
+HpackDecoder::HpackDecoder(int maxTableSize, int maxHeaderListSize)
+    : maxTableSize(maxTableSize), maxHeaderListSize(maxHeaderListSize) {
+	table.setMaxSize(maxTableSize);
+}
+
+bool HpackDecoder::decode(const QByteArray &block, QList<Http2Header> &headers) {
+	const uchar *data = reinterpret_cast<const uchar *>(block.constData());
+	int size = block.size();
+	int pos = 0;
+	int listSize = 0;
+	bool sizeUpdateAllowed = true;
+	while (pos < size) {
+		uchar first = data[pos];
+		Http2Header header;
+		if (first & 0x80) {
+			// Indexed header field
+			quint32 index;
+			if (!decodeInteger(data, size, pos, 7, index) || !table.lookup(index, header)) {
+				return false;
+			}
+		} else if ((first & 0xe0) == 0x20) {
+			// Dynamic table size update, only allowed at the beginning of a block
+			quint32 newSize;
+			if (!sizeUpdateAllowed || !decodeInteger(data, size, pos, 5, newSize) || newSize > quint32(maxTableSize)) {
+				return false;
+			}
+			table.setMaxSize(int(newSize));
+			continue;
+		} else {
+			// Literal header field with incremental indexing (6 bit prefix), without indexing or never indexed
+			bool indexing = (first & 0xc0) == 0x40;
+			quint32 index;
+			if (!decodeInteger(data, size, pos, indexing ? 6 : 4, index)) {
+				return false;
+			}
+			if (index > 0 ? !table.lookup(index, header) : !decodeString(data, size, pos, header.first)) {
+				return false;
+			}
+			if (!decodeString(data, size, pos, header.second)) {
+				return false;
+			}
+			if (indexing) {
+				table.insert(header);
+			}
+		}
+		sizeUpdateAllowed = false;
+		listSize += header.first.size() + header.second.size() + 32;
+		if (listSize > maxHeaderListSize) {
+			qWarning("HpackDecoder: header list is too large");
+			return false;
+		}
+		headers.append(header);
+	}
+	return true;
+}
+
+HpackEncoder::HpackEncoder() {
+	table.setMaxSize(maxEncoderTableSize);
+	sizeUpdatePending = false;
+	minPendingSize = maxEncoderTableSize;
+}
+
+void HpackEncoder::setMaxTableSize(quint32 size) {
+	int newSize = int(qMin(size, quint32(maxEncoderTableSize)));
+	if (newSize == table.getMaxSize()) {
+		return;
+	}
+	minPendingSize = sizeUpdatePending ? qMin(minPendingSize, newSize) : newSize;
+	sizeUpdatePending = true;
+	table.setMaxSize(newSize);
+}
+
+void HpackEncoder::encode(const QList<Http2Header> &headers, QByteArray &block) {
+	// Announce a changed table size, including the smallest size in between
+	if (sizeUpdatePending) {
+		if (minPendingSize < table.getMaxSize()) {
+			encodeInteger(block, 0x20, 5, quint32(minPendingSize));
+		}
+		encodeInteger(block, 0x20, 5, quint32(table.getMaxSize()));
+		sizeUpdatePending = false;
+	}
+
+	foreach (const Http2Header &header, headers) {
+		quint32 nameIndex;
+		quint32 index = table.find(header, nameIndex);
+		if (index > 0) {
+			encodeInteger(block, 0x80, 7, index);
+			continue;
+		}
+		if (header.first == "set-cookie") {
+			// Never indexed, so that intermediaries don't compress it either
+			encodeInteger(block, 0x10, 4, nameIndex);
+		} else if (header.first == "content-length" || header.first == "etag" || header.first == "last-modified") {
+			// Without indexing, these values rarely repeat
+			encodeInteger(block, 0x00, 4, nameIndex);
+		} else {
+			// With incremental indexing
+			encodeInteger(block, 0x40, 6, nameIndex);
+			table.insert(header);
+		}
+		if (nameIndex == 0) {
+			encodeString(block, header.first);
+		}
+		encodeString(block, header.second);
+	}
+}
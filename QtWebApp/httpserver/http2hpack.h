@@ -0,0 +1,127 @@
+#pragma once
+
+#include "qtwebappglobal.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+
+namespace qtwebapp {
+
+	/** A HTTP/2 header field, consisting of name and value. Names are always lower-case. */
+	typedef QPair<QByteArray, QByteArray> Http2Header;
+
+	/**
+	  The static and dynamic table of HPACK (RFC 7541). Indexes start at 1, the entries of
+	  the dynamic table follow the 61 entries of the static table, newest entry first.
+	*/
+	class QTWEBAPP_EXPORT HpackTable {
+	  public:
+		/** Constructor, the maximum size of the dynamic table is 4096 bytes */
+		HpackTable();
+
+		/**
+		  Get the entry at an index.
+		  @return False if there is no such entry
+		*/
+		bool lookup(quint32 index, Http2Header &header) const;
+
+		/**
+		  Search an entry.
+		  @param header The entry to search
+		  @param nameIndex Set to the index of an entry with the same name, or 0 if the name is not in the table
+		  @return Index of an entry with the same name and value, or 0 if not found
+		*/
+		quint32 find(const Http2Header &header, quint32 &nameIndex) const;
+
+		/** Add an entry to the dynamic table, evicting old entries if necessary. */
+		void insert(const Http2Header &header);
+
+		/** Change the maximum size of the dynamic table, evicting old entries if necessary. */
+		void setMaxSize(int size);
+
+		/** Get the maximum size of the dynamic table */
+		int getMaxSize() const;
+
+	  private:
+		/** Entries of the dynamic table, newest first */
+		QList<Http2Header> entries;
+
+		/** Size of the dynamic table as defined by HPACK, that is 32 bytes overhead for each entry */
+		int size;
+
+		/** Maximum size of the dynamic table */
+		int maxSize;
+
+		/** Remove the oldest entries until the table does not exceed the given size */
+		void evict(int limit);
+	};
+
+	/**
+	  Decoder for HPACK, the header compression of HTTP/2. Each connection has its own decoder,
+	  because the dynamic table is shared by all header blocks that the client sends.
+	*/
+	class QTWEBAPP_EXPORT HpackDecoder {
+		Q_DISABLE_COPY(HpackDecoder)
+	  public:
+		/**
+		  Constructor.
+		  @param maxTableSize Maximum size of the dynamic table, as announced in SETTINGS_HEADER_TABLE_SIZE
+		  @param maxHeaderListSize Maximum size of a decoded header list, as defined by HTTP/2
+		*/
+		HpackDecoder(int maxTableSize, int maxHeaderListSize);
+
+		/**
+		  Decode a complete header block.
+		  @param block The header block, collected from HEADERS and CONTINUATION frames
+		  @param headers Receives the decoded header fields in their order
+		  @return False if the block is broken or too large. The dynamic table is not usable after that.
+		*/
+		bool decode(const QByteArray &block, QList<Http2Header> &headers);
+
+	  private:
+		/** Static and dynamic table */
+		HpackTable table;
+
+		/** Maximum size of the dynamic table that the client may choose */
+		int maxTableSize;
+
+		/** Maximum size of a decoded header list */
+		int maxHeaderListSize;
+	};
+
+	/**
+	  Encoder for HPACK. Header fields are added to the dynamic table, so repeated response
+	  headers are sent as a single byte. Cookies are never indexed.
+	*/
+	class QTWEBAPP_EXPORT HpackEncoder {
+		Q_DISABLE_COPY(HpackEncoder)
+	  public:
+		/** Constructor */
+		HpackEncoder();
+
+		/**
+		  Set the maximum size of the dynamic table, as announced by the client in SETTINGS_HEADER_TABLE_SIZE.
+		  The encoder uses at most 4096 bytes.
+		*/
+		void setMaxTableSize(quint32 size);
+
+		/**
+		  Encode a header block.
+		  @param headers Header fields with lower-case names
+		  @param block The encoded fields are appended to this buffer
+		*/
+		void encode(const QList<Http2Header> &headers, QByteArray &block);
+
+	  private:
+		/** Static and dynamic table */
+		HpackTable table;
+
+		/** Whether the size of the dynamic table must be announced in the next header block */
+		bool sizeUpdatePending;
+
+		/** Smallest size of the dynamic table since the last announcement */
+		int minPendingSize;
+	};
+
+} // namespace qtwebapp
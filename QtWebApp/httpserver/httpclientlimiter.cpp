@@ -0,0 +1,149 @@
+#include "httpclientlimiter.h"
+
+#ifdef Q_OS_WIN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+
+using namespace qtwebapp;
+
+HttpClientLimiter::HttpClientLimiter(const HttpServerConfig &cfg) {
+	maxConnections = cfg.maxConnectionsPerClient;
+	rate = cfg.clientRequestRate;
+	burst = cfg.clientRequestBurst > 0 ? cfg.clientRequestBurst : cfg.clientRequestRate;
+	clock.start();
+	for (int i = 0; i < shardCount; i++) {
+		shards[i].cleanupTime = 0;
+	}
+}
+
+bool HttpClientLimiter::isEnabled() const {
+	return maxConnections > 0 || rate > 0;
+}
+
+HttpClientLimiter::Key HttpClientLimiter::key(const QHostAddress &address) {
+	// Use the layout of IPv4-mapped IPv6 addresses for IPv4, so that both give the same key
+	bool ipv4 = false;
+	quint32 ipv4Address = address.toIPv4Address(&ipv4);
+	if (ipv4) {
+		return Key(0, Q_UINT64_C(0xffff00000000) | ipv4Address);
+	}
+	Q_IPV6ADDR ipv6Address = address.toIPv6Address();
+	quint64 high = 0;
+	quint64 low = 0;
+	for (int i = 0; i < 8; i++) {
+		high = (high << 8) | ipv6Address[i];
+		low = (low << 8) | ipv6Address[i + 8];
+	}
+	return Key(high, low);
+}
+
+HttpClientLimiter::Shard &HttpClientLimiter::shard(const Key &key) const {
+	return shards[qHash(key) % shardCount];
+}
+
+void HttpClientLimiter::refill(Client &client, qint64 now) const {
+	client.tokens = qMin(burst, client.tokens + (now - client.refillTime) * rate / 1000);
+	client.refillTime = now;
+}
+
+void HttpClientLimiter::cleanup(Shard &shard, qint64 now) {
+	// Scan the shard only every 10 seconds, so the cost is spread over many calls
+	if (now - shard.cleanupTime < 10000) {
+		return;
+	}
+	shard.cleanupTime = now;
+	QHash<Key, Client>::iterator i = shard.clients.begin();
+	while (i != shard.clients.end()) {
+		if (i->connections == 0) {
+			refill(*i, now);
+			if (rate <= 0 || i->tokens >= burst) {
+				i = shard.clients.erase(i);
+				continue;
+			}
+		}
+		++i;
+	}
+}
+
+bool HttpClientLimiter::addConnection(const QHostAddress &address) {
+	if (address.isNull() || !isEnabled()) {
+		return true;
+	}
+	Key k = key(address);
+	Shard &s = shard(k);
+	qint64 now = clock.elapsed();
+	QMutexLocker locker(&s.mutex);
+	cleanup(s, now);
+	QHash<Key, Client>::iterator i = s.clients.find(k);
+	if (i == s.clients.end()) {
+		Client client;
+		client.connections = 0;
+		client.tokens = burst;
+		client.refillTime = now;
+		i = s.clients.insert(k, client);
+	}
+	if (maxConnections > 0 && i->connections >= maxConnections) {
+		return false;
+	}
+	i->connections++;
+	return true;
+}
+
+void HttpClientLimiter::removeConnection(const QHostAddress &address) {
+	if (address.isNull() || !isEnabled()) {
+		return;
+	}
+	Key k = key(address);
+	Shard &s = shard(k);
+	QMutexLocker locker(&s.mutex);
+	QHash<Key, Client>::iterator i = s.clients.find(k);
+	if (i != s.clients.end() && i->connections > 0) {
+		i->connections--;
+	}
+}
+
+bool HttpClientLimiter::takeRequestToken(const QHostAddress &address) {
+	if (address.isNull() || rate <= 0) {
+		return true;
+	}
+	Key k = key(address);
+	Shard &s = shard(k);
+	qint64 now = clock.elapsed();
+	QMutexLocker locker(&s.mutex);
+	QHash<Key, Client>::iterator i = s.clients.find(k);
+	if (i == s.clients.end()) {
+		// The entry exists while the client has connections, but HTTP/2 requests may arrive after a restart
+		Client client;
+		client.connections = 0;
+		client.tokens = burst;
+		client.refillTime = now;
+		i = s.clients.insert(k, client);
+	}
+	refill(*i, now);
+	if (i->tokens < 1) {
+		return false;
+	}
+	i->tokens -= 1;
+	return true;
+}
+
+int HttpClientLimiter::getClientCount() const {
+	int count = 0;
+	for (int i = 0; i < shardCount; i++) {
+		QMutexLocker locker(&shards[i].mutex);
+		count += shards[i].clients.size();
+	}
+	return count;
+}
+
+QHostAddress HttpClientLimiter::peerAddress(qintptr socketDescriptor) {
+	sockaddr_storage storage;
+	socklen_t length = sizeof(storage);
+	if (getpeername(socketDescriptor, reinterpret_cast<sockaddr *>(&storage), &length) != 0) {
+		return QHostAddress();
+	}
+	return QHostAddress(reinterpret_cast<sockaddr *>(&storage));
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "httpserverconfig.h"
+#include "qtwebappglobal.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QMutex>
+#include <QPair>
+
+namespace qtwebapp {
+
+	/**
+	  Limits the concurrent connections and the request rate of each client IP address, so that a single
+	  client cannot occupy all connection handlers. The listener counts a connection when it is accepted,
+	  and the connection handler releases it when the connection is closed or handed over to a WebSocket or
+	  an event channel. Requests are limited with a token bucket per address, which allows bursts of
+	  clientRequestBurst requests and refills at clientRequestRate requests per second.
+	  <p>
+	  The addresses are stored in a table that is split into shards with their own mutex, so that threads
+	  rarely wait for each other. Entries of clients without connections are removed when their bucket is
+	  full again. All methods are thread safe.
+	  <p>
+	  Connections on a Unix domain socket have no peer address, they are not limited.
+	  <p>
+	  Example for the configuration settings:
+	  <code><pre>
+	  maxConnectionsPerClient=20
+	  clientRequestRate=50
+	  clientRequestBurst=100
+	  </pre></code>
+	*/
+	class QTWEBAPP_EXPORT HttpClientLimiter {
+		Q_DISABLE_COPY(HttpClientLimiter)
+
+	  public:
+		/** Constructor */
+		HttpClientLimiter(const HttpServerConfig &cfg);
+
+		/** Returns true, if any limit is configured */
+		bool isEnabled() const;
+
+		/**
+		  Count a new connection of a client.
+		  @return False if the client has reached maxConnectionsPerClient, the connection is not counted then
+		*/
+		bool addConnection(const QHostAddress &address);
+
+		/** Release a connection that has been counted by addConnection() */
+		void removeConnection(const QHostAddress &address);
+
+		/**
+		  Take a token for a request of a client.
+		  @return False if the client has exceeded its request rate
+		*/
+		bool takeRequestToken(const QHostAddress &address);
+
+		/** Get the number of client addresses in the table */
+		int getClientCount() const;
+
+		/**
+		  Get the address of the peer of a connected socket, before a QTcpSocket has been created for it.
+		  @return The address, or a null address if it cannot be determined
+		*/
+		static QHostAddress peerAddress(qintptr socketDescriptor);
+
+	  private:
+		/** Compact key of an IPv4 or IPv6 address, IPv4-mapped IPv6 addresses are stored as IPv4 */
+		typedef QPair<quint64, quint64> Key;
+
+		/** State of a client */
+		struct Client {
+			/** Number of open connections */
+			int connections;
+
+			/** Number of available request tokens */
+			double tokens;
+
+			/** Time of the last refill of the tokens */
+			qint64 refillTime;
+		};
+
+		/** A part of the table */
+		struct Shard {
+			QMutex mutex;
+			QHash<Key, Client> clients;
+
+			/** Time of the last removal of unused entries */
+			qint64 cleanupTime;
+		};
+
+		enum { shardCount = 16 };
+
+		/** Maximum number of concurrent connections of a client, 0 for unlimited */
+		int maxConnections;
+
+		/** Refill rate of the tokens per second, 0 for unlimited */
+		double rate;
+
+		/** Capacity of the token buckets */
+		double burst;
+
+		/** Time base for the token buckets */
+		QElapsedTimer clock;
+
+		/** The table of clients */
+		mutable Shard shards[shardCount];
+
+		/** Get the key of an address */
+		static Key key(const QHostAddress &address);
+
+		/** Get the shard of a key */
+		Shard &shard(const Key &key) const;
+
+		/** Refill the tokens of a client */
+		void refill(Client &client, qint64 now) const;
+
+		/** Remove the entries of idle clients whose bucket is full, the caller must hold the mutex */
+		void cleanup(Shard &shard, qint64 now);
+	};
+
+} // namespace qtwebapp
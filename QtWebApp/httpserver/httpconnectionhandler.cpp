@@ -5,18 +5,40 @@
 
 #include "httpconnectionhandler.h"
 
+#include "eventchannel.h"
+#include "eventstream.h"
 #include "httpresponse.h"
 
 using namespace qtwebapp;
 
 HttpConnectionHandler::HttpConnectionHandler(const HttpServerConfig &cfg, HttpRequestHandler *requestHandler,
-                                             const QSslConfiguration *sslConfiguration)
+                                             const QSharedPointer<QSslConfiguration> &sslConfiguration,
+                                             QThread *ioThread, HttpServerStatistics *statistics,
+                                             HttpClientLimiter *clientLimiter, QThreadPool *pipelinePool)
     : QObject(), cfg(cfg) {
 	Q_ASSERT(requestHandler != nullptr);
 	this->requestHandler = requestHandler;
 	this->sslConfiguration = sslConfiguration;
+	sslSupported = !sslConfiguration.isNull();
+	this->ioThread = ioThread;
+	this->statistics = statistics;
+	this->clientLimiter = clientLimiter;
+	this->pipelinePool = pipelinePool;
+	pipelineBuffer.bufferedBytes = 0;
+	pipelineBuffer.bufferLimit = cfg.pipelineBufferSize;
+	pipelineBuffer.connected.storeRelease(1);
+	clientCounted = false;
+	handshakePending = false;
 	currentRequest = nullptr;
+	http2 = nullptr;
+	http2Running = false;
+	detectProtocol = false;
 	busy = false;
+	deadline = 0;
+	timeoutType = idleTimeout;
+	bodyStartTime = 0;
+	bodyStartSize = 0;
+	clock.start();
 
 	// execute signals in a new thread
 	thread = new QThread();
@@ -31,8 +53,6 @@ HttpConnectionHandler::HttpConnectionHandler(const HttpServerConfig &cfg, HttpRe
 	socket->moveToThread(thread);
 
 	// Connect signals
-	connect(socket, SIGNAL(readyRead()), SLOT(read()));
-	connect(socket, SIGNAL(disconnected()), SLOT(disconnected()));
 	connect(&readTimer, SIGNAL(timeout()), SLOT(readTimeout()));
 	connect(thread, SIGNAL(finished()), this, SLOT(thread_done()));
 
@@ -43,6 +63,12 @@ HttpConnectionHandler::HttpConnectionHandler(const HttpServerConfig &cfg, HttpRe
 
 void HttpConnectionHandler::thread_done() {
 	readTimer.stop();
+	releaseClient();
+	delete http2;
+	http2 = nullptr;
+	// The thread pool must not access the handler after it has been deleted, the responses are discarded
+	pipelineBuffer.connected.storeRelease(0);
+	finishPipeline();
 	socket->close();
 	delete socket;
 	qDebug("HttpConnectionHandler (%p): thread stopped", static_cast<void *>(this));
@@ -52,6 +78,7 @@ HttpConnectionHandler::~HttpConnectionHandler() {
 	thread->quit();
 	thread->wait();
 	thread->deleteLater();
+	delete currentRequest;
 #ifdef CMAKE_DEBUG
 	qDebug("HttpConnectionHandler (%p): destroyed", static_cast<void *>(this));
 #endif
@@ -60,18 +87,21 @@ HttpConnectionHandler::~HttpConnectionHandler() {
 void HttpConnectionHandler::createSocket() {
 	// If SSL is supported and configured, then create an instance of QSslSocket
 #ifndef QT_NO_OPENSSL
-	if (sslConfiguration) {
+	if (sslSupported) {
+		// Without startServerEncryption(), a QSslSocket works like a QTcpSocket
 		QSslSocket *sslSocket = new QSslSocket();
-		sslSocket->setSslConfiguration(*sslConfiguration);
+		connect(sslSocket, SIGNAL(encrypted()), SLOT(encrypted()));
 		socket = sslSocket;
 #ifdef CMAKE_DEBUG
 		qDebug("HttpConnectionHandler (%p): SSL is enabled", static_cast<void *>(this));
 #endif
-		return;
-	}
+	} else
 #endif
-	// else create an instance of QTcpSocket
-	socket = new QTcpSocket();
+		// else create an instance of QTcpSocket
+		socket = new QTcpSocket();
+
+	connect(socket, SIGNAL(readyRead()), SLOT(read()));
+	connect(socket, SIGNAL(disconnected()), SLOT(disconnected()));
 }
 
 void HttpConnectionHandler::handleConnection(qintptr socketDescriptor) {
@@ -86,27 +116,53 @@ void HttpConnectionHandler::handleConnection(qintptr socketDescriptor) {
 	socket->connectToHost("", 0);
 	socket->abort();
 
+	// The listener has counted the connection of the client
+	if (clientLimiter && clientLimiter->isEnabled()) {
+		clientAddress = HttpClientLimiter::peerAddress(socketDescriptor);
+		clientCounted = true;
+	}
+
 	if (!socket->setSocketDescriptor(socketDescriptor)) {
 		qCritical("HttpConnectionHandler (%p): cannot initialize socket: %s", static_cast<void *>(this),
 		          qPrintable(socket->errorString()));
+		releaseClient();
+		busy = false;
+		emit idle();
 		return;
 	}
+	if (statistics) {
+		statistics->connections.ref();
+	}
+	if (cfg.tcpNoDelay) {
+		socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+	}
 
 #ifndef QT_NO_OPENSSL
 	// Switch on encryption, if SSL is configured
 	if (sslConfiguration) {
 #ifdef CMAKE_DEBUG
 		qDebug("HttpConnectionHandler (%p): Starting encryption", static_cast<void *>(this));
-		(static_cast<QSslSocket *>(socket))->startServerEncryption();
 #endif
+		// The handshake does not block, it proceeds in the event loop as data arrives. The read timeout
+		// also limits the duration of the handshake.
+		handshakePending = true;
+		QSslSocket *sslSocket = static_cast<QSslSocket *>(socket);
+		// The configuration may have been reloaded since the socket has been created
+		sslSocket->setSslConfiguration(*sslConfiguration);
+		sslSocket->startServerEncryption();
 	}
 #endif
 
-	// Start timer for read timeout
-	readTimer.start(cfg.readTimeout);
-	// delete previous request
-	delete currentRequest;
-	currentRequest = nullptr;
+	// Wait for the first request. Sending nothing is treated like an idle keep-alive connection.
+	startTimeout(idleTimeout, cfg.readTimeout);
+	// reset previous request
+	if (currentRequest) {
+		currentRequest->reset();
+	}
+	// The HTTP/2 connection of the previous connection is deleted here if the client closed it
+	delete http2;
+	http2 = nullptr;
+	detectProtocol = cfg.http2;
 }
 
 bool HttpConnectionHandler::isBusy() {
@@ -117,16 +173,81 @@ void HttpConnectionHandler::setBusy() {
 	this->busy = true;
 }
 
+void HttpConnectionHandler::stop() {
+	thread->quit();
+}
+
+bool HttpConnectionHandler::isStopped() {
+	return thread->isFinished();
+}
+
+void HttpConnectionHandler::setSslConfiguration(const QSharedPointer<QSslConfiguration> &sslConfiguration) {
+	// SSL cannot be switched on without a QSslSocket
+	if (sslSupported) {
+		this->sslConfiguration = sslConfiguration;
+	}
+}
+
+void HttpConnectionHandler::startTimeout(TimeoutType type, int msec) {
+	timeoutType = type;
+	deadline = clock.elapsed() + msec;
+	// The timer is only restarted if it would expire too late. When it expires before an extended
+	// deadline, it is started again for the remaining time.
+	if (!readTimer.isActive() || readTimer.remainingTime() > msec) {
+		readTimer.start(msec);
+	}
+}
+
+int HttpConnectionHandler::bodyTimeoutInterval() const {
+	if (cfg.minBodyRate <= 0) {
+		return cfg.readTimeout;
+	}
+	// A client that sends a few bytes now and then would otherwise keep the handler busy forever
+	qint64 now = clock.elapsed();
+	qint64 received = currentRequest->currentSize - bodyStartSize;
+	qint64 rateDeadline = bodyStartTime + cfg.readTimeout + received * 1000 / cfg.minBodyRate;
+	return int(qBound(qint64(0), rateDeadline - now, qint64(cfg.readTimeout)));
+}
+
 void HttpConnectionHandler::readTimeout() {
-	qDebug("HttpConnectionHandler (%p): read timeout occured", static_cast<void *>(this));
+	qint64 remaining = deadline - clock.elapsed();
+	if (remaining > 0) {
+		readTimer.start(int(remaining));
+		return;
+	}
+
+	// Idle keep-alive connections are closed without a response
+	if (timeoutType == idleTimeout && !http2) {
+#ifdef SUPERVERBOSE
+		qDebug("HttpConnectionHandler (%p): closing idle connection", static_cast<void *>(this));
+#endif
+		socket->disconnectFromHost();
+		return;
+	}
+
+	qDebug("HttpConnectionHandler (%p): %s timeout occured", static_cast<void *>(this),
+	       timeoutType == headerTimeout ? "header" : "read");
+	if (statistics && timeoutType != idleTimeout) {
+		statistics->requestTimeouts.ref();
+	}
+
+	if (http2) {
+		http2Running = true;
+		http2->goAway();
+		http2Running = false;
+		delete http2;
+		http2 = nullptr;
+		return;
+	}
 
 	socket->write("HTTP/1.1 408 request timeout\r\nConnection: close\r\n\r\n408 request timeout\r\n");
 
 	while (socket->bytesToWrite())
 		socket->waitForBytesWritten();
 	socket->disconnectFromHost();
-	delete currentRequest;
-	currentRequest = nullptr;
+	if (currentRequest) {
+		currentRequest->reset();
+	}
 }
 
 void HttpConnectionHandler::disconnected() {
@@ -135,10 +256,251 @@ void HttpConnectionHandler::disconnected() {
 #endif
 	socket->close();
 	readTimer.stop();
+	if (handshakePending) {
+		handshakePending = false;
+		if (statistics) {
+			statistics->tlsHandshakeFailures.ref();
+		}
+	}
+	if (http2 && !http2Running) {
+		delete http2;
+		http2 = nullptr;
+	}
+	releaseClient();
 	busy = false;
+	emit idle();
+}
+
+void HttpConnectionHandler::drain() {
+	// The flag is seen by a request that is serviced at the moment, the socket is closed in the own thread
+	draining.storeRelease(1);
+	emit goingAway();
+	QMetaObject::invokeMethod(this, "drainConnection", Qt::QueuedConnection);
+}
+
+void HttpConnectionHandler::drainConnection() {
+	if (!socket->isOpen()) {
+		return;
+	}
+#ifdef CMAKE_DEBUG
+	qDebug("HttpConnectionHandler (%p): draining", static_cast<void *>(this));
+#endif
+	// The streams that the client has opened already are still serviced
+	if (http2) {
+		http2Running = true;
+		http2->drain();
+		http2Running = false;
+		if (socket->state() != QAbstractSocket::ConnectedState) {
+			delete http2;
+			http2 = nullptr;
+		}
+		return;
+	}
+	if (timeoutType == idleTimeout && (!currentRequest || currentRequest->getStatus() == HttpRequest::waitForRequest)) {
+		socket->disconnectFromHost();
+	}
+}
+
+void HttpConnectionHandler::releaseClient() {
+	if (clientCounted) {
+		clientCounted = false;
+		clientLimiter->removeConnection(clientAddress);
+	}
+}
+
+bool HttpConnectionHandler::limitRequestRate() {
+	if (!clientLimiter || clientLimiter->takeRequestToken(clientAddress)) {
+		return true;
+	}
+	if (!finishPipeline()) {
+		return false;
+	}
+	qWarning("HttpConnectionHandler (%p): too many requests from %s", static_cast<void *>(this),
+	         qPrintable(clientAddress.toString()));
+	if (statistics) {
+		statistics->limitedRequests.ref();
+	}
+	socket->write("HTTP/1.1 429 Too Many Requests\r\nRetry-After: " + QByteArray::number(cfg.retryAfter) +
+	              "\r\nConnection: close\r\n\r\n429 too many requests\r\n");
+	while (socket->bytesToWrite())
+		socket->waitForBytesWritten();
+	socket->disconnectFromHost();
+	currentRequest->reset();
+	return false;
+}
+
+void HttpConnectionHandler::encrypted() {
+#ifdef SUPERVERBOSE
+	qDebug("HttpConnectionHandler (%p): TLS handshake completed", static_cast<void *>(this));
+#endif
+	handshakePending = false;
+	if (statistics) {
+		statistics->tlsHandshakes.ref();
+	}
+}
+
+bool HttpConnectionHandler::startHttp2() {
+	bool alpn = false;
+#ifndef QT_NO_OPENSSL
+	if (sslConfiguration) {
+		alpn = static_cast<QSslSocket *>(socket)->sslConfiguration().nextNegotiatedProtocol() == "h2";
+	}
+#endif
+	// Without ALPN, HTTP/2 is detected by the connection preface (h2c with prior knowledge)
+	QByteArray start = socket->peek(qstrlen(Http2Connection::preface));
+	if (!alpn && !QByteArray(Http2Connection::preface).startsWith(start)) {
+		detectProtocol = false;
+		return true;
+	}
+	if (!alpn && start.size() < int(qstrlen(Http2Connection::preface))) {
+		return false;
+	}
+#ifdef CMAKE_DEBUG
+	qDebug("HttpConnectionHandler (%p): switching to HTTP/2", static_cast<void *>(this));
+#endif
+	detectProtocol = false;
+	http2 = new Http2Connection(socket, cfg, requestHandler, clientLimiter, statistics);
+	return true;
+}
+
+void HttpConnectionHandler::readHttp2() {
+	http2Running = true;
+	http2->read();
+	http2Running = false;
+	if (socket->state() != QAbstractSocket::ConnectedState) {
+		delete http2;
+		http2 = nullptr;
+	} else {
+		// Start timer for the next request, it closes idle connections
+		startTimeout(idleTimeout, cfg.keepAliveTimeout);
+	}
+}
+
+bool HttpConnectionHandler::isWebSocketUpgrade() const {
+	return currentRequest->getMethod() == "GET" && currentRequest->headerEquals("upgrade", "websocket") &&
+	       currentRequest->rawHeader("connection").toLower().contains("upgrade") &&
+	       !currentRequest->rawHeader("sec-websocket-key").isEmpty() &&
+	       currentRequest->headerEquals("sec-websocket-version", "13");
+}
+
+bool HttpConnectionHandler::upgradeWebSocket() {
+	WebSocket *webSocket = new WebSocket(cfg);
+	HttpResponse response(socket, cfg);
+	bool accepted = false;
+	try {
+		accepted = requestHandler->acceptWebSocket(*currentRequest, response, webSocket);
+	} catch (...) {
+		qCritical("HttpConnectionHandler (%p): An uncatched exception occured in the request handler",
+		          static_cast<void *>(this));
+	}
+	if (!accepted) {
+		delete webSocket;
+		return false;
+	}
+#ifdef CMAKE_DEBUG
+	qDebug("HttpConnectionHandler (%p): upgrading to WebSocket", static_cast<void *>(this));
+#endif
+
+	// Send the handshake response
+	response.setStatus(101);
+	response.setHeader("Upgrade", "websocket");
+	response.setHeader("Connection", "Upgrade");
+	response.setHeader("Sec-WebSocket-Accept", WebSocket::acceptKey(currentRequest->getHeader("Sec-WebSocket-Key")));
+	QByteArray extensions =
+	    webSocket->negotiateCompression(currentRequest->getHeaders("Sec-WebSocket-Extensions").join(','));
+	if (!extensions.isEmpty()) {
+		response.setHeader("Sec-WebSocket-Extensions", extensions);
+	}
+	response.write(QByteArray(), true);
+
+	// Hand the socket over to the WebSocket and get ready for the next connection
+	webSocket->open(takeSocket(), ioThread ? ioThread : thread);
+	connect(this, SIGNAL(goingAway()), webSocket, SLOT(drain()));
+	if (draining.loadAcquire()) {
+		webSocket->close(WebSocket::goingAway);
+	}
+	return true;
+}
+
+QTcpSocket *HttpConnectionHandler::takeSocket() {
+	readTimer.stop();
+	socket->disconnect(this);
+	QTcpSocket *takenSocket = socket;
+	createSocket();
+	currentRequest->reset();
+	releaseClient();
+	busy = false;
+	emit idle();
+	return takenSocket;
+}
+
+bool HttpConnectionHandler::startBody(bool &streamBody) {
+	// Only 100-continue is a known expectation, and it must be ignored for HTTP 1.0 clients
+	QByteArray expect = currentRequest->getHeader("Expect");
+	bool http1_0 = qstricmp(currentRequest->version.constData(), "HTTP/1.0") == 0;
+	bool expectContinue = !http1_0 && currentRequest->headerEquals("expect", "100-continue");
+	if (!http1_0 && !expect.isEmpty() && !expectContinue) {
+		qWarning("HttpConnectionHandler (%p): unsupported expectation %s", static_cast<void *>(this), expect.data());
+		socket->write("HTTP/1.1 417 expectation failed\r\nConnection: close\r\n\r\n417 expectation failed\r\n");
+		while (socket->bytesToWrite())
+			socket->waitForBytesWritten();
+		socket->disconnectFromHost();
+		currentRequest->reset();
+		return false;
+	}
+
+	// Let the request handler reject the request before the body is transferred
+	HttpResponse response(socket, cfg);
+	response.setHeader("Connection", "close");
+	bool accepted = false;
+	try {
+		accepted = requestHandler->acceptRequest(*currentRequest, response);
+	} catch (...) {
+		qCritical("HttpConnectionHandler (%p): An uncatched exception occured in the request handler",
+		          static_cast<void *>(this));
+	}
+	if (!accepted) {
+#ifdef CMAKE_DEBUG
+		qDebug("HttpConnectionHandler (%p): request rejected before receiving the body", static_cast<void *>(this));
+#endif
+		if (!response.hasSentLastPart()) {
+			if (response.getStatusCode() == 200) {
+				response.setStatus(403, "forbidden");
+				response.write("403 forbidden", true);
+			} else {
+				response.write(QByteArray(), true);
+			}
+		}
+		while (socket->bytesToWrite())
+			socket->waitForBytesWritten();
+		socket->disconnectFromHost();
+		currentRequest->reset();
+		return false;
+	}
+
+	streamBody = requestHandler->streamRequestBody(*currentRequest);
+	currentRequest->startBody(socket, streamBody);
+
+	// Tell the client to send the body, unless the request has already been aborted because it is too large
+	if (expectContinue && currentRequest->getStatus() == HttpRequest::waitForBody) {
+#ifdef SUPERVERBOSE
+		qDebug("HttpConnectionHandler (%p): sending 100 continue", static_cast<void *>(this));
+#endif
+		socket->write("HTTP/1.1 100 Continue\r\n\r\n");
+		socket->flush();
+	}
+	return true;
 }
 
 void HttpConnectionHandler::read() {
+	if (detectProtocol && !startHttp2()) {
+		return;
+	}
+	if (http2) {
+		readHttp2();
+		return;
+	}
+
 	// The loop adds support for HTTP pipelinig
 	while (socket->bytesAvailable()) {
 #ifdef SUPERVERBOSE
@@ -151,38 +513,90 @@ void HttpConnectionHandler::read() {
 		}
 
 		// Collect data for the request object
+		bool streamBody = false;
 		while (socket->bytesAvailable() && currentRequest->getStatus() != HttpRequest::complete &&
 		       currentRequest->getStatus() != HttpRequest::abort) {
+			// The headers of a new request must be complete before a fixed deadline, which is not extended by
+			// further data
+			if (timeoutType == idleTimeout) {
+				startTimeout(headerTimeout, cfg.headerTimeout);
+			}
+			HttpRequest::RequestStatus previousStatus = currentRequest->getStatus();
 			currentRequest->readFromSocket(socket);
+			if (previousStatus == HttpRequest::waitForHeader && currentRequest->getStatus() != previousStatus &&
+			    currentRequest->getStatus() != HttpRequest::abort && !limitRequestRate()) {
+				return;
+			}
+			if (previousStatus == HttpRequest::waitForHeader &&
+			    currentRequest->getStatus() == HttpRequest::waitForBody) {
+				// All headers have been received, ask the request handler how to receive the body. Its answer
+				// must not overtake the responses of the previous requests.
+				if (!finishPipeline()) {
+					return;
+				}
+				bodyStartTime = clock.elapsed();
+				bodyStartSize = currentRequest->currentSize;
+				if (!startBody(streamBody)) {
+					return;
+				}
+				if (streamBody) {
+					break;
+				}
+			}
 			if (currentRequest->getStatus() == HttpRequest::waitForBody) {
-				// Restart timer for read timeout, otherwise it would
+				// Extend the read timeout, otherwise it would
 				// expire during large file uploads.
-				readTimer.start(cfg.readTimeout);
+				startTimeout(bodyTimeout, bodyTimeoutInterval());
 			}
 		}
 
+		// Service pipelined requests concurrently if possible
+		if (currentRequest->getStatus() == HttpRequest::complete && !streamBody && pipelineRequest()) {
+			continue;
+		}
+
+		// The responses of the previous requests are sent first
+		if (!finishPipeline()) {
+			return;
+		}
+
 		// If the request is aborted, return error message and close the connection
 		if (currentRequest->getStatus() == HttpRequest::abort) {
-			socket->write("HTTP/1.1 413 entity too large\r\nConnection: close\r\n\r\n413 Entity too large\r\n");
+			if (currentRequest->headerTooLarge) {
+				socket->write("HTTP/1.1 431 Request Header Fields Too Large\r\nConnection: close\r\n\r\n"
+				              "431 Request header fields too large\r\n");
+			} else if (currentRequest->uriTooLong) {
+				socket->write("HTTP/1.1 414 URI Too Long\r\nConnection: close\r\n\r\n414 URI too long\r\n");
+			} else if (currentRequest->unsupportedEncoding) {
+				socket->write("HTTP/1.1 501 Not Implemented\r\nConnection: close\r\n\r\n"
+				              "501 Transfer encoding not implemented\r\n");
+			} else {
+				socket->write("HTTP/1.1 413 entity too large\r\nConnection: close\r\n\r\n413 Entity too large\r\n");
+			}
 			while (socket->bytesToWrite())
 				socket->waitForBytesWritten();
 			socket->disconnectFromHost();
-			delete currentRequest;
-			currentRequest = nullptr;
+			currentRequest->reset();
+			return;
+		}
+
+		// Hand the connection over to a WebSocket if the request handler accepts the upgrade
+		if (currentRequest->getStatus() == HttpRequest::complete && isWebSocketUpgrade() && upgradeWebSocket()) {
 			return;
 		}
 
-		// If the request is complete, let the request mapper dispatch it
-		if (currentRequest->getStatus() == HttpRequest::complete) {
+		// If the request is complete or its body is streamed, let the request mapper dispatch it
+		if (currentRequest->getStatus() == HttpRequest::complete || streamBody) {
 			readTimer.stop();
 #ifdef CMAKE_DEBUG
 			qDebug("HttpConnectionHandler (%p): received request", static_cast<void *>(this));
 #endif
 
 			// Copy the Connection:close header to the response
-			HttpResponse response(socket);
-			bool closeConnection =
-			    QString::compare(currentRequest->getHeader("Connection"), "close", Qt::CaseInsensitive) == 0;
+			HttpResponse response(socket, cfg);
+			response.draining = &draining;
+			response.statistics = statistics;
+			bool closeConnection = currentRequest->headerEquals("connection", "close");
 			if (closeConnection) {
 				response.setHeader("Connection", "close");
 			}
@@ -190,13 +604,24 @@ void HttpConnectionHandler::read() {
 			// In case of HTTP 1.0 protocol add the Connection:close header.
 			// This ensures that the HttpResponse does not activate chunked mode, which is not spported by HTTP 1.0.
 			else {
-				bool http1_0 = QString::compare(currentRequest->getVersion(), "HTTP/1.0", Qt::CaseInsensitive) == 0;
+				bool http1_0 = qstricmp(currentRequest->version.constData(), "HTTP/1.0") == 0;
 				if (http1_0) {
 					closeConnection = true;
 					response.setHeader("Connection", "close");
 				}
 			}
 
+			// Do not keep the connection while the server shuts down
+			if (draining.loadAcquire() && !closeConnection) {
+				closeConnection = true;
+				response.setHeader("Connection", "close");
+			}
+
+			// Limit the socket buffer while streaming, so that a slow request handler slows down the client
+			if (streamBody) {
+				socket->setReadBufferSize(cfg.streamBufferSize);
+			}
+
 			// Call the request mapper
 			try {
 				requestHandler->service(*currentRequest, response);
@@ -205,6 +630,24 @@ void HttpConnectionHandler::read() {
 				          static_cast<void *>(this));
 			}
 
+			// If the request handler did not read the whole streamed body, the connection cannot be reused
+			if (streamBody) {
+				socket->setReadBufferSize(0);
+				if (!currentRequest->getBodyDevice()->isComplete()) {
+					closeConnection = true;
+				}
+			}
+
+			// Hand the connection over to the channel if the response has been subscribed to Server-Sent Events
+			if (response.eventChannel) {
+				EventStream *stream = response.eventChannel->attach(takeSocket(), ioThread ? ioThread : thread);
+				connect(this, SIGNAL(goingAway()), stream, SLOT(closeSubscribers()), Qt::UniqueConnection);
+				if (draining.loadAcquire()) {
+					QMetaObject::invokeMethod(stream, "closeSubscribers", Qt::QueuedConnection);
+				}
+				return;
+			}
+
 			// Finalize sending the response if not already done
 			if (!response.hasSentLastPart()) {
 				response.write(QByteArray(), true);
@@ -214,25 +657,9 @@ void HttpConnectionHandler::read() {
 			qDebug("HttpConnectionHandler (%p): finished request", static_cast<void *>(this));
 #endif
 
-			// Find out whether the connection must be closed
+			// Find out whether the connection must be closed, the server may have started to shut down meanwhile
 			if (!closeConnection) {
-				// Maybe the request handler or mapper added a Connection:close header in the meantime
-				bool closeResponse =
-				    QString::compare(response.getHeaders().value("Connection"), "close", Qt::CaseInsensitive) == 0;
-				if (closeResponse == true) {
-					closeConnection = true;
-				} else {
-					// If we have no Content-Length header and did not use chunked mode, then we have to close the
-					// connection to tell the HTTP client that the end of the response has been reached.
-					bool hasContentLength = response.getHeaders().contains("Content-Length");
-					if (!hasContentLength) {
-						bool hasChunkedMode = QString::compare(response.getHeaders().value("Transfer-Encoding"), "chunked",
-						                                       Qt::CaseInsensitive) == 0;
-						if (!hasChunkedMode) {
-							closeConnection = true;
-						}
-					}
-				}
+				closeConnection = closesConnection(response) || draining.loadAcquire();
 			}
 
 			// Close the connection or prepare for the next request on the same connection.
@@ -242,11 +669,140 @@ void HttpConnectionHandler::read() {
 				socket->disconnectFromHost();
 			} else {
 				// Start timer for next request
-				readTimer.start(cfg.readTimeout);
+				startTimeout(idleTimeout, cfg.keepAliveTimeout);
+			}
+			currentRequest->reset();
+		}
+	}
+	finishPipeline();
+}
+
+bool HttpConnectionHandler::closesConnection(HttpResponse &response) {
+	// Maybe the request handler or mapper added a Connection:close header in the meantime
+	bool closeResponse = QString::compare(response.getHeaders().value("Connection"), "close", Qt::CaseInsensitive) == 0;
+	if (closeResponse == true) {
+		return true;
+	}
+	// If we have no Content-Length header and did not use chunked mode, then we have to close the
+	// connection to tell the HTTP client that the end of the response has been reached.
+	bool hasContentLength = response.getHeaders().contains("Content-Length");
+	if (!hasContentLength) {
+		bool hasChunkedMode =
+		    QString::compare(response.getHeaders().value("Transfer-Encoding"), "chunked", Qt::CaseInsensitive) == 0;
+		if (!hasChunkedMode) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool HttpConnectionHandler::pipelineRequest() {
+	// Only requests that the client sent without waiting for the previous response are serviced concurrently
+	if (!pipelinePool || cfg.pipelineConcurrency < 2 || draining.loadAcquire() ||
+	    pipeline.size() >= cfg.pipelineConcurrency || (pipeline.isEmpty() && socket->bytesAvailable() == 0)) {
+		return false;
+	}
+	QByteArray method = currentRequest->getMethod();
+	if ((method != "GET" && method != "HEAD") || isWebSocketUpgrade() ||
+	    currentRequest->headerEquals("connection", "close") ||
+	    qstricmp(currentRequest->version.constData(), "HTTP/1.1") != 0) {
+		return false;
+	}
+	readTimer.stop();
+
+	HttpPipelinedRequest *pipelinedRequest =
+	    new HttpPipelinedRequest(&pipelineBuffer, currentRequest, requestHandler, cfg, &draining);
+	pipelinedRequest->response.statistics = statistics;
+	pipeline.append(pipelinedRequest);
+	pipelinePool->start(pipelinedRequest);
+	if (statistics) {
+		statistics->pipelinedRequests.ref();
+	}
+	// The pipelined request owns the object now
+	currentRequest = new HttpRequest(cfg);
+	startTimeout(idleTimeout, cfg.keepAliveTimeout);
+	return true;
+}
+
+bool HttpConnectionHandler::finishPipeline() {
+	if (pipeline.isEmpty()) {
+		return true;
+	}
+	bool open = pipelineBuffer.connected.loadAcquire() && socket->state() == QAbstractSocket::ConnectedState;
+	if (!open) {
+		pipelineBuffer.connected.storeRelease(0);
+	}
+	QByteArray output;
+	foreach (HttpPipelinedRequest *pipelinedRequest, pipeline) {
+		// Responses that are complete at the same time are sent with a single write. Before waiting for more
+		// data of the next response, the collected data is sent.
+		bool complete = pipelinedRequest->take(output, false);
+		while (!complete) {
+			if (open && !output.isEmpty() && !writePipelined(output)) {
+				open = false;
+				pipelineBuffer.connected.storeRelease(0);
+			}
+			output.clear();
+			complete = pipelinedRequest->take(output, true);
+		}
+		if (!open) {
+			// The remaining requests must still finish before they are deleted
+			output.clear();
+			continue;
+		}
+		HttpResponse &response = pipelinedRequest->response;
+		if (response.truncated || closesConnection(response)) {
+			open = false;
+			pipelineBuffer.connected.storeRelease(0);
+			socket->write(output);
+			output.clear();
+			while (socket->bytesToWrite())
+				socket->waitForBytesWritten();
+			if (response.truncated) {
+				socket->abort();
+			} else {
+				socket->disconnectFromHost();
 			}
-			delete currentRequest;
-			currentRequest = nullptr;
-			currentRequest = nullptr;
+		} else if (output.size() >= pipelineBuffer.bufferLimit) {
+			if (!writePipelined(output)) {
+				open = false;
+				pipelineBuffer.connected.storeRelease(0);
+			}
+			output.clear();
+		}
+	}
+	if (open && !output.isEmpty()) {
+		socket->write(output);
+		socket->flush();
+	}
+	qDeleteAll(pipeline);
+	pipeline.clear();
+	// The next connection starts with an empty buffer
+	pipelineBuffer.bufferedBytes = 0;
+	pipelineBuffer.connected.storeRelease(1);
+	if (!open) {
+		if (currentRequest) {
+			currentRequest->reset();
+		}
+		return false;
+	}
+	// Servicing the requests took some time
+	if (timeoutType == idleTimeout) {
+		startTimeout(idleTimeout, cfg.keepAliveTimeout);
+	}
+	return true;
+}
+
+bool HttpConnectionHandler::writePipelined(const QByteArray &data) {
+	socket->write(data);
+	socket->flush();
+	// Otherwise the socket would buffer what the limit keeps out of the responses
+	while (socket->bytesToWrite() > 16384 && socket->state() == QAbstractSocket::ConnectedState) {
+		if (!socket->waitForBytesWritten(cfg.writeTimeout) && socket->bytesToWrite() > 16384) {
+			qWarning("HttpConnectionHandler (%p): write timeout, closing the connection", static_cast<void *>(this));
+			socket->abort();
+			return false;
 		}
 	}
+	return socket->state() == QAbstractSocket::ConnectedState;
 }
@@ -5,13 +5,22 @@
 
 #pragma once
 
+#include "http2connection.h"
+#include "httpclientlimiter.h"
+#include "httppipelinedrequest.h"
 #include "httprequest.h"
 #include "httprequesthandler.h"
 #include "httpserverconfig.h"
+#include "httpserverstatistics.h"
 #include "qtwebappglobal.h"
+#include "websocket.h"
 
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QSharedPointer>
 #include <QTcpSocket>
 #include <QThread>
+#include <QThreadPool>
 #include <QTimer>
 
 #ifndef QT_NO_SSL
@@ -30,14 +39,44 @@ namespace qtwebapp {
 	  request mapper. Since HTTP clients can send multiple requests before waiting for the response,
 	  the incoming requests are queued and processed one after the other.
 	  <p>
+	  With pipelineConcurrency > 1, pipelined GET and HEAD requests that have already been received are
+	  serviced concurrently by the thread pool of the HttpConnectionHandlerPool instead, which has
+	  pipelineThreads threads for all connections. Their responses are collected in memory, at most
+	  pipelineBufferSize bytes per connection, and sent in the order of the requests. The response that is
+	  sent next is passed to the socket while it is generated, responses that are complete at the same time
+	  are sent with a single write.
+	  Requests with a body, WebSocket upgrades and requests that close the connection are still processed
+	  by the connection handler itself, after the responses of the previous requests have been sent.
+	  Such responses cannot be subscribed to an EventChannel.
+	  <p>
 	  Example for the required configuration settings:
 	  <code><pre>
-	  readTimeout=60000
+	  readTimeout=10000
+	  headerTimeout=10000
+	  minBodyRate=500
+	  keepAliveTimeout=10000
+	  writeTimeout=60000
 	  maxRequestSize=16000
 	  maxMultiPartSize=1000000
 	  </pre></code>
 	  <p>
-	  The readTimeout value defines the maximum time to wait for a complete HTTP request.
+	  The readTimeout value defines the maximum time to wait for the first request of a connection and for
+	  each part of a request body. The headers of a request must be received within headerTimeout after
+	  its first byte. If minBodyRate is configured, a body must also arrive at that many bytes per second on
+	  average after the first readTimeout, so that a client cannot hold a handler by sending a few bytes now
+	  and then. Between
+	  requests, idle connections are closed after keepAliveTimeout. The
+	  writeTimeout limits the time that a response waits for a client that does not receive data.
+	  <p>
+	  Timeouts are tracked as deadlines. Extending a deadline, e.g. for each part of a large upload, does
+	  not restart the timer. The timer is only started again when it expires before the deadline.
+	  <p>
+	  If http2 is enabled, connections that start with the HTTP/2 connection preface or negotiate h2
+	  with ALPN are handed over to a Http2Connection.
+	  <p>
+	  After an accepted WebSocket upgrade, or when the response has been subscribed to an EventChannel,
+	  the socket is handed over to the I/O thread of the pool, and the handler is free for the next
+	  connection.
 	  @see HttpRequest for description of config settings maxRequestSize and maxMultiPartSize.
 	*/
 	class QTWEBAPP_EXPORT HttpConnectionHandler : public QObject {
@@ -49,10 +88,19 @@ namespace qtwebapp {
 		  Constructor.
 		  @param settings Configuration settings of the HTTP webserver
 		  @param requestHandler Handler that will process each incoming HTTP request
-		  @param sslConfiguration SSL (HTTPS) will be used if not NULL
+		  @param sslConfiguration SSL (HTTPS) will be used if not NULL, see setSslConfiguration()
+		  @param ioThread Thread that processes the events of upgraded WebSocket connections. If NULL,
+		  they stay in the thread of this handler.
+		  @param statistics Counters that are updated by this handler, may be NULL
+		  @param clientLimiter Limits of the client IP addresses, may be NULL
+		  @param pipelinePool Services pipelined requests if pipelineConcurrency > 1. If NULL, they are
+		  serviced one after the other.
 		*/
-		HttpConnectionHandler(const HttpServerConfig &cfg, HttpRequestHandler *requestHandler,
-		                      const QSslConfiguration *sslConfiguration = nullptr);
+		HttpConnectionHandler(
+		    const HttpServerConfig &cfg, HttpRequestHandler *requestHandler,
+		    const QSharedPointer<QSslConfiguration> &sslConfiguration = QSharedPointer<QSslConfiguration>(),
+		    QThread *ioThread = nullptr, HttpServerStatistics *statistics = nullptr,
+		    HttpClientLimiter *clientLimiter = nullptr, QThreadPool *pipelinePool = nullptr);
 
 		/** Destructor */
 		virtual ~HttpConnectionHandler();
@@ -63,6 +111,31 @@ namespace qtwebapp {
 		/** Mark this handler as busy */
 		void setBusy();
 
+		/**
+		  Stop the thread of this idle handler without waiting for it, used by the pool to shrink
+		  without blocking. The handler must be deleted after isStopped() returned true.
+		*/
+		void stop();
+
+		/** Returns true, if the thread of this handler has finished after stop() */
+		bool isStopped();
+
+		/**
+		  Set the SSL configuration for the next connection, used by the pool for the endpoint of the connection
+		  and after the configuration has been reloaded. NULL accepts the next connection without encryption.
+		  SSL cannot be enabled if the handler has been created without SSL configuration.
+		*/
+		void setSslConfiguration(const QSharedPointer<QSslConfiguration> &sslConfiguration);
+
+		/**
+		  Called by the pool when the server shuts down gracefully. This method is thread safe. A response
+		  that has not sent its headers yet gets Connection: close, even if its request is in progress, and
+		  an idle keep-alive connection is closed immediately. A HTTP/2 connection sends GOAWAY and is closed
+		  after the streams that the client has opened already. WebSockets and event streams that have been
+		  handed over by this handler are closed as well.
+		*/
+		void drain();
+
 	  private:
 		/** Configuration */
 		HttpServerConfig cfg;
@@ -73,10 +146,38 @@ namespace qtwebapp {
 		/** The thread that processes events of this connection */ /** The thread that processes events of this connection */
 		QThread *thread;
 
+		/** The thread that processes events of upgraded WebSocket connections */
+		QThread *ioThread;
+
+		/** The kinds of timeouts of a connection */
+		enum TimeoutType {
+			/** Waiting for the next request */
+			idleTimeout,
+			/** Waiting for the headers of a request */
+			headerTimeout,
+			/** Waiting for the body of a request */
+			bodyTimeout
+		};
+
 		/** Time for read timeout detection */
 		QTimer readTimer;
 
-		/** Storage for the current incoming HTTP request */
+		/** Monotonic clock for the deadline */
+		QElapsedTimer clock;
+
+		/** Time of the clock when the current timeout expires */
+		qint64 deadline;
+
+		/** The kind of the current timeout */
+		TimeoutType timeoutType;
+
+		/** Time of the clock when the body of the current request started */
+		qint64 bodyStartTime;
+
+		/** Size of the current request when its body started */
+		int bodyStartSize;
+
+		/** Storage for the current incoming HTTP request, reused for all requests of this handler */
 		HttpRequest *currentRequest;
 
 		/** Dispatches received requests to services */
@@ -85,12 +186,137 @@ namespace qtwebapp {
 		/** This shows the busy-state from a very early time */
 		bool busy;
 
-		/** Configuration for SSL */
-		const QSslConfiguration *sslConfiguration;
+		/** Configuration for SSL, used for the next connection */
+		QSharedPointer<QSslConfiguration> sslConfiguration;
+
+		/** Whether the socket is a QSslSocket, which can accept encrypted and unencrypted connections */
+		bool sslSupported;
+
+		/** Counters of the listener, or nullptr */
+		HttpServerStatistics *statistics;
+
+		/** Limits of the client IP addresses, or nullptr */
+		HttpClientLimiter *clientLimiter;
+
+		/** The IP address of the current client */
+		QHostAddress clientAddress;
+
+		/** Whether the connection of the current client is counted by the client limiter */
+		bool clientCounted;
+
+		/** Whether the TLS handshake of the current connection has been started but not completed */
+		bool handshakePending;
+
+		/** HTTP/2 connection, or nullptr if the current connection uses HTTP/1.x */
+		Http2Connection *http2;
+
+		/** Whether a method of the HTTP/2 connection is running, so it must not be deleted */
+		bool http2Running;
 
-		/**  Create SSL or TCP socket */
+		/** Whether the server shuts down, connections are closed after the current request. Set by drain(). */
+		QAtomicInt draining;
+
+		/** Whether the protocol of the current connection has not been detected yet */
+		bool detectProtocol;
+
+		/** Pipelined requests that are serviced concurrently, in the order of their arrival */
+		QList<HttpPipelinedRequest *> pipeline;
+
+		/** Services the pipelined requests, or nullptr */
+		QThreadPool *pipelinePool;
+
+		/** The state shared with the pipelined requests */
+		HttpPipelineBuffer pipelineBuffer;
+
+		/**
+		  Service the current request concurrently, if it is a pipelined request that allows that. A new
+		  object receives the next request then.
+		  @return False if the request must be serviced by the connection handler
+		*/
+		bool pipelineRequest();
+
+		/**
+		  Wait for the pipelined requests and send their responses in order. If the connection is closed,
+		  the remaining responses are discarded.
+		  @return False if the connection has been closed by one of the responses
+		*/
+		bool finishPipeline();
+
+		/**
+		  Write responses of pipelined requests to the socket, waiting while its buffer is large.
+		  @return False if the connection has been closed
+		*/
+		bool writePipelined(const QByteArray &data);
+
+		/** Find out whether the connection must be closed after a response, because its end is not marked */
+		bool closesConnection(HttpResponse &response);
+
+		/**
+		  Switch to HTTP/2 if the client negotiated h2 with ALPN or sent the HTTP/2 connection preface.
+		  @return False if more data is needed to detect the protocol
+		*/
+		bool startHttp2();
+
+		/** Let the HTTP/2 connection process incoming data, and delete it when the connection has been closed */
+		void readHttp2();
+
+		/**
+		  Set the deadline of the connection. This is cheap, the timer is only restarted if it would expire
+		  after the new deadline.
+		  @param type The kind of timeout, which decides how the connection is closed
+		  @param msec Time from now until the deadline
+		*/
+		void startTimeout(TimeoutType type, int msec);
+
+		/**
+		  Get the time until the body of the current request must have progressed. Each chunk of the body
+		  extends the deadline by readTimeout, but after the first readTimeout the body must also arrive at
+		  minBodyRate on average.
+		*/
+		int bodyTimeoutInterval() const;
+
+		/**  Create SSL or TCP socket and connect its signals */
 		void createSocket();
 
+		/** Release the connection of the current client in the client limiter */
+		void releaseClient();
+
+		/**
+		  Take a request token of the current client. If the client has exceeded its request rate,
+		  a 429 response is sent and the connection is closed.
+		  @return False if the request has been rejected
+		*/
+		bool limitRequestRate();
+
+		/**
+		  Check whether the current request is a WebSocket handshake.
+		*/
+		bool isWebSocketUpgrade() const;
+
+		/**
+		  Let the request handler decide about a WebSocket upgrade. If accepted, the 101 response is sent,
+		  the socket is handed over to the WebSocket and a new socket is created for the next connection.
+		  @return False if the request handler rejected the upgrade
+		*/
+		bool upgradeWebSocket();
+
+		/**
+		  Release the socket of the current connection, which is taken over by a WebSocket or an EventChannel,
+		  and create a new socket for the next connection.
+		  @return The released socket, not connected to this handler anymore
+		*/
+		QTcpSocket *takeSocket();
+
+		/**
+		  Prepare receiving the body of the current request after all headers have been received.
+		  This asks the request handler whether the request is accepted and whether the body should be
+		  streamed, and answers Expect: 100-continue. If the request is rejected, the response is sent,
+		  the connection is closed and the current request is reset.
+		  @param streamBody Set to whether the body is streamed to the request handler
+		  @return False if the request has been rejected
+		*/
+		bool startBody(bool &streamBody);
+
 	  public slots:
 
 		/**
@@ -99,9 +325,17 @@ namespace qtwebapp {
 		*/
 		void handleConnection(qintptr socketDescriptor);
 
+	  signals:
+
+		/** Emitted when this handler is free for the next connection */
+		void idle();
+
+		/** Emitted by drain(), closes the WebSockets and event streams that have been handed over */
+		void goingAway();
+
 	  private slots:
 
-		/** Received from the socket when a read-timeout occured */
+		/** Received from the timer when a deadline may have been reached */
 		void readTimeout();
 
 		/** Received from the socket when incoming data can be read */
@@ -110,8 +344,14 @@ namespace qtwebapp {
 		/** Received from the socket when a connection has been closed */
 		void disconnected();
 
+		/** Received from the SSL socket when the TLS handshake has been completed */
+		void encrypted();
+
 		/** Cleanup after the thread is closed */
 		void thread_done();
+
+		/** Invoked by drain(), closes the connection in the thread of this handler */
+		void drainConnection();
 	};
 
 } // namespace qtwebapp
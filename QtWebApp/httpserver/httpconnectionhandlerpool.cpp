@@ -3,6 +3,7 @@
 #include "httplistener.h"
 
 #include <QDir>
+#include <QFileSystemWatcher>
 
 #ifndef QT_NO_OPENSSL
 #include <QSslCertificate>
@@ -13,10 +14,56 @@
 
 using namespace qtwebapp;
 
-HttpConnectionHandlerPool::HttpConnectionHandlerPool(const HttpServerConfig &cfg, HttpRequestHandler *requestHandler)
-    : QObject(), cfg(cfg), requestHandler(requestHandler) {
-	sslConfiguration = nullptr;
-	loadSslConfig();
+HttpConnectionHandlerPool::HttpConnectionHandlerPool(const HttpServerConfig &cfg, HttpRequestHandler *requestHandler,
+                                                     HttpServerStatistics *statistics,
+                                                     const QSharedPointer<HttpPoolPolicy> &policy,
+                                                     HttpClientLimiter *clientLimiter)
+    : QObject(), cfg(cfg), requestHandler(requestHandler), statistics(statistics), clientLimiter(clientLimiter),
+      policy(policy) {
+	if (!this->policy) {
+		this->policy = QSharedPointer<HttpPoolPolicy>(new AdaptivePoolPolicy());
+	}
+	acceptedCounter = 0;
+	createdCounter = 0;
+	draining = false;
+	sslWatcher = nullptr;
+	// Endpoint 0 is host and port, the others are the additional endpoints
+	sslKeyFiles << cfg.sslKeyFile;
+	sslCertFiles << cfg.sslCertFile;
+	foreach (const HttpEndpointConfig &endpoint, cfg.endpoints) {
+		if (!endpoint.ssl) {
+			sslKeyFiles << QString();
+			sslCertFiles << QString();
+		} else if (!endpoint.sslKeyFile.isEmpty() && !endpoint.sslCertFile.isEmpty()) {
+			sslKeyFiles << endpoint.sslKeyFile;
+			sslCertFiles << endpoint.sslCertFile;
+		} else {
+			sslKeyFiles << cfg.sslKeyFile;
+			sslCertFiles << cfg.sslCertFile;
+		}
+		if (endpoint.ssl && (sslKeyFiles.last().isEmpty() || sslCertFiles.last().isEmpty())) {
+			qCritical("HttpConnectionHandlerPool: no sslKeyFile and sslCertFile for the endpoint on port %i",
+			          endpoint.port);
+		}
+	}
+	for (int i = 0; i < sslKeyFiles.size(); i++) {
+		sslConfigurations << loadSslConfig(sslKeyFiles.at(i), sslCertFiles.at(i));
+	}
+	if (handlerSslConfiguration() && cfg.sslAutoReload) {
+		// Watch the files for changes, they are replaced when the certificate is renewed
+		watchSslFiles();
+		sslReloadTimer.setSingleShot(true);
+		connect(&sslReloadTimer, SIGNAL(timeout()), SLOT(sslReloadTimeout()));
+	}
+	ioThread = new QThread();
+	ioThread->start();
+	pipelinePool.setMaxThreadCount(qMax(1, cfg.pipelineThreads));
+	// Start the minimum number of threads now, so the first requests do not wait for them
+	mutex.lock();
+	while (pool.count() < cfg.minThreads) {
+		createHandler();
+	}
+	mutex.unlock();
 	cleanupTimer.start(cfg.cleanupInterval);
 	connect(&cleanupTimer, SIGNAL(timeout()), SLOT(cleanup()));
 }
@@ -26,15 +73,22 @@ HttpConnectionHandlerPool::~HttpConnectionHandlerPool() {
 	foreach (HttpConnectionHandler *handler, pool) {
 		delete handler;
 	}
-	delete sslConfiguration;
+	foreach (HttpConnectionHandler *handler, retired) {
+		delete handler;
+	}
+	// close all WebSocket connections
+	ioThread->quit();
+	ioThread->wait();
+	delete ioThread;
 #ifdef CMAKE_DEBUG
 	qDebug("HttpConnectionHandlerPool (%p): destroyed", this);
 #endif
 }
 
-HttpConnectionHandler *HttpConnectionHandlerPool::getConnectionHandler() {
+HttpConnectionHandler *HttpConnectionHandlerPool::getConnectionHandler(int endpoint) {
 	HttpConnectionHandler *freeHandler = nullptr;
 	mutex.lock();
+	acceptedCounter++;
 	// find a free handler in pool
 	foreach (HttpConnectionHandler *handler, pool) {
 		if (!handler->isBusy()) {
@@ -47,83 +101,263 @@ HttpConnectionHandler *HttpConnectionHandlerPool::getConnectionHandler() {
 	if (!freeHandler) {
 		int maxConnectionHandlers = cfg.maxThreads;
 		if (pool.count() < maxConnectionHandlers) {
-			freeHandler = new HttpConnectionHandler(cfg, requestHandler, sslConfiguration);
+			freeHandler = createHandler();
 			freeHandler->setBusy();
-			pool.append(freeHandler);
+			createdCounter++;
 		}
 	}
+	if (freeHandler) {
+		freeHandler->setSslConfiguration(sslConfigurations.value(endpoint));
+	}
 	mutex.unlock();
 	return freeHandler;
 }
 
+void HttpConnectionHandlerPool::setPolicy(const QSharedPointer<HttpPoolPolicy> &policy) {
+	QMutexLocker locker(&mutex);
+	this->policy = policy ? policy : QSharedPointer<HttpPoolPolicy>(new AdaptivePoolPolicy());
+}
+
+void HttpConnectionHandlerPool::drain() {
+	QMutexLocker locker(&mutex);
+	foreach (HttpConnectionHandler *handler, pool) {
+		handler->drain();
+	}
+	// Retired handlers may have handed over WebSockets and event streams
+	foreach (HttpConnectionHandler *handler, retired) {
+		handler->drain();
+	}
+	draining = true;
+	cleanupTimer.stop();
+}
+
+int HttpConnectionHandlerPool::getBusyCount() {
+	QMutexLocker locker(&mutex);
+	int busyCount = 0;
+	foreach (HttpConnectionHandler *handler, pool) {
+		if (handler->isBusy()) {
+			busyCount++;
+		}
+	}
+	return busyCount;
+}
+
+HttpConnectionHandler *HttpConnectionHandlerPool::createHandler() {
+	HttpConnectionHandler *handler =
+	    new HttpConnectionHandler(cfg, requestHandler, handlerSslConfiguration(), ioThread, statistics, clientLimiter,
+	                              cfg.pipelineConcurrency > 1 ? &pipelinePool : nullptr);
+	connect(handler, SIGNAL(idle()), SIGNAL(handlerAvailable()));
+	if (draining) {
+		handler->drain();
+	}
+	pool.append(handler);
+	if (statistics) {
+		statistics->handlersCreated.ref();
+		statistics->poolSize.storeRelease(pool.size());
+	}
+	return handler;
+}
+
 void HttpConnectionHandlerPool::cleanup() {
-	int maxIdleHandlers = cfg.minThreads;
-	int idleCounter = 0;
-	mutex.lock();
+	QMutexLocker locker(&mutex);
+
+	// Delete the retired handlers whose threads have finished, so this never waits for a thread
+	for (int i = retired.size() - 1; i >= 0; i--) {
+		if (retired.at(i)->isStopped()) {
+			delete retired.takeAt(i);
+		}
+	}
+
+	HttpPoolStatus status;
+	status.size = pool.size();
+	status.busy = 0;
 	foreach (HttpConnectionHandler *handler, pool) {
-		if (!handler->isBusy()) {
-			if (++idleCounter > maxIdleHandlers) {
-				delete handler;
+		if (handler->isBusy()) {
+			status.busy++;
+		}
+	}
+	status.accepted = acceptedCounter;
+	status.created = createdCounter;
+	status.minThreads = cfg.minThreads;
+	status.maxThreads = cfg.maxThreads;
+	acceptedCounter = 0;
+	createdCounter = 0;
+	int target = qBound(cfg.minThreads, policy->targetSize(status), cfg.maxThreads);
+
+	// Grow ahead of the demand
+	bool grown = pool.size() < target;
+	while (pool.size() < target) {
+		createHandler();
+	}
+
+	// Shrink slowly, only one idle handler in each interval
+	if (pool.size() > target) {
+		foreach (HttpConnectionHandler *handler, pool) {
+			if (!handler->isBusy()) {
 				pool.removeOne(handler);
-				long int poolSize = (long int)pool.size();
+				handler->stop();
+				retired.append(handler);
+				if (statistics) {
+					statistics->handlersRetired.ref();
+				}
 #ifdef CMAKE_DEBUG
-				qDebug("HttpConnectionHandlerPool: Removed connection handler (%p), pool size is now %li", handler,
-				       poolSize);
+				qDebug("HttpConnectionHandlerPool: Removed connection handler (%p), pool size is now %i",
+				       static_cast<void *>(handler), int(pool.size()));
 #endif
-				break; // remove only one handler in each interval
+				break;
 			}
 		}
 	}
-	mutex.unlock();
+
+	if (statistics) {
+		statistics->poolSize.storeRelease(pool.size());
+		statistics->busyHandlers.storeRelease(status.busy);
+		statistics->poolTargetSize.storeRelease(target);
+	}
+	locker.unlock();
+	if (grown) {
+		emit handlerAvailable();
+	}
 }
 
-void HttpConnectionHandlerPool::loadSslConfig() {
+QString HttpConnectionHandlerPool::sslFilePath(const QString &fileName) const {
+	// Convert relative fileNames to absolute, based on the directory of the config file.
+	if (!cfg.fileName.isEmpty() && QDir::isRelativePath(fileName)) {
+		return QFileInfo(QFileInfo(cfg.fileName).absolutePath(), fileName).absoluteFilePath();
+	}
+	return fileName;
+}
+
+QSharedPointer<QSslConfiguration> HttpConnectionHandlerPool::handlerSslConfiguration() const {
+	foreach (const QSharedPointer<QSslConfiguration> &configuration, sslConfigurations) {
+		if (configuration) {
+			return configuration;
+		}
+	}
+	return QSharedPointer<QSslConfiguration>();
+}
+
+QSharedPointer<QSslConfiguration> HttpConnectionHandlerPool::loadSslConfig(const QString &sslKeyFile,
+                                                                           const QString &sslCertFile) {
+	QSharedPointer<QSslConfiguration> configuration;
 	// If certificate and key files are configured, then load them
-	QString sslKeyFileName = cfg.sslKeyFile;
-	QString sslCertFileName = cfg.sslCertFile;
+	QString sslKeyFileName = sslKeyFile;
+	QString sslCertFileName = sslCertFile;
 	if (!sslKeyFileName.isEmpty() && !sslCertFileName.isEmpty()) {
 #ifdef QT_NO_OPENSSL
 		qWarning("HttpConnectionHandlerPool: SSL is not supported");
 #else
-		// Convert relative fileNames to absolute, based on the directory of the config file.
-		if (!cfg.fileName.isEmpty()) {
-			QFileInfo configFile(cfg.fileName);
-			if (QDir::isRelativePath(sslKeyFileName)) {
-				sslKeyFileName = QFileInfo(configFile.absolutePath(), sslKeyFileName).absoluteFilePath();
-			}
-			if (QDir::isRelativePath(sslCertFileName)) {
-				sslCertFileName = QFileInfo(configFile.absolutePath(), sslCertFileName).absoluteFilePath();
-			}
-		}
+		sslKeyFileName = sslFilePath(sslKeyFileName);
+		sslCertFileName = sslFilePath(sslCertFileName);
 
 		// Load the SSL certificate
 		QFile certFile(sslCertFileName);
 		if (!certFile.open(QIODevice::ReadOnly)) {
 			qCritical("HttpConnectionHandlerPool: cannot open sslCertFile %s", qPrintable(sslCertFileName));
-			return;
+			return configuration;
 		}
 		QSslCertificate certificate(&certFile, QSsl::Pem);
 		certFile.close();
+		if (certificate.isNull()) {
+			qCritical("HttpConnectionHandlerPool: cannot load sslCertFile %s", qPrintable(sslCertFileName));
+			return configuration;
+		}
 
-		// Load the key file
+		// Load the key file, which may contain a RSA or an ECDSA key
 		QFile keyFile(sslKeyFileName);
 		if (!keyFile.open(QIODevice::ReadOnly)) {
 			qCritical("HttpConnectionHandlerPool: cannot open sslKeyFile %s", qPrintable(sslKeyFileName));
-			return;
+			return configuration;
 		}
-		QSslKey sslKey(&keyFile, QSsl::Rsa, QSsl::Pem);
+		QByteArray keyData = keyFile.readAll();
 		keyFile.close();
+		QSslKey sslKey(keyData, QSsl::Rsa, QSsl::Pem);
+		if (sslKey.isNull()) {
+			sslKey = QSslKey(keyData, QSsl::Ec, QSsl::Pem);
+		}
+		if (sslKey.isNull()) {
+			qCritical("HttpConnectionHandlerPool: cannot load sslKeyFile %s", qPrintable(sslKeyFileName));
+			return configuration;
+		}
 
 		// Create the SSL configuration
-		sslConfiguration = new QSslConfiguration();
-		sslConfiguration->setLocalCertificate(certificate);
-		sslConfiguration->setPrivateKey(sslKey);
-		sslConfiguration->setPeerVerifyMode(QSslSocket::VerifyNone);
-		sslConfiguration->setProtocol(QSsl::SecureProtocols);
+		configuration = QSharedPointer<QSslConfiguration>(new QSslConfiguration());
+		configuration->setLocalCertificate(certificate);
+		configuration->setPrivateKey(sslKey);
+		configuration->setPeerVerifyMode(QSslSocket::VerifyNone);
+		configuration->setProtocol(QSsl::SecureProtocols);
+		// Let clients resume sessions with tickets as far as the TLS backend allows
+		configuration->setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+		if (cfg.http2) {
+			// Offer HTTP/2 with ALPN
+			configuration->setAllowedNextProtocols(QList<QByteArray>() << "h2" << "http/1.1");
+		}
 
 #ifdef CMAKE_DEBUG
 		qDebug("HttpConnectionHandlerPool: SSL settings loaded");
 #endif
 #endif // QT_NO_OPENSSL
 	}
+	return configuration;
+}
+
+bool HttpConnectionHandlerPool::reloadSslConfig() {
+	QMutexLocker locker(&mutex);
+	if (!handlerSslConfiguration()) {
+		qWarning("HttpConnectionHandlerPool: SSL is not enabled, cannot reload the SSL configuration");
+		return false;
+	}
+	locker.unlock();
+	// The file lists do not change after construction
+	bool reloaded = true;
+	QList<QSharedPointer<QSslConfiguration>> configurations;
+	for (int i = 0; i < sslKeyFiles.size(); i++) {
+		QSharedPointer<QSslConfiguration> configuration;
+		if (!sslKeyFiles.at(i).isEmpty() && !sslCertFiles.at(i).isEmpty()) {
+			configuration = loadSslConfig(sslKeyFiles.at(i), sslCertFiles.at(i));
+			if (!configuration) {
+				qWarning("HttpConnectionHandlerPool: keeping the previous SSL configuration");
+				reloaded = false;
+			}
+		}
+		configurations << configuration;
+	}
+	// Connections that have already been accepted keep their copy of the previous configuration
+	locker.relock();
+	for (int i = 0; i < configurations.size(); i++) {
+		if (configurations.at(i)) {
+			sslConfigurations[i] = configurations.at(i);
+		}
+	}
+	if (reloaded) {
+		qDebug("HttpConnectionHandlerPool: SSL configuration reloaded");
+	}
+	return reloaded;
+}
+
+void HttpConnectionHandlerPool::watchSslFiles() {
+	if (!sslWatcher) {
+		sslWatcher = new QFileSystemWatcher(this);
+		connect(sslWatcher, SIGNAL(fileChanged(QString)), SLOT(sslFileChanged()));
+	}
+	// Files that have been replaced are removed from the watcher, so they are added again
+	foreach (const QString &fileName, sslKeyFiles + sslCertFiles) {
+		if (fileName.isEmpty()) {
+			continue;
+		}
+		QString path = sslFilePath(fileName);
+		if (!sslWatcher->files().contains(path)) {
+			sslWatcher->addPath(path);
+		}
+	}
+}
+
+void HttpConnectionHandlerPool::sslFileChanged() {
+	// Key and certificate are usually written one after the other, so wait until both have been replaced
+	sslReloadTimer.start(1000);
+}
+
+void HttpConnectionHandlerPool::sslReloadTimeout() {
+	reloadSslConfig();
+	watchSslFiles();
 }
@@ -1,12 +1,19 @@
 #pragma once
 
 #include "httpconnectionhandler.h"
+#include "httppoolpolicy.h"
 #include "httpserverconfig.h"
+#include "httpserverstatistics.h"
 #include "qtwebappglobal.h"
 
 #include <QList>
 #include <QMutex>
+#include <QFileSystemWatcher>
 #include <QObject>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QThread>
+#include <QThreadPool>
 #include <QTimer>
 
 namespace qtwebapp {
@@ -23,13 +30,18 @@ namespace qtwebapp {
 	  readTimeout=60000
 	  ;sslKeyFile=ssl/my.key
 	  ;sslCertFile=ssl/my.cert
+	  ;sslAutoReload=true
 	  maxRequestSize=16000
 	  maxMultiPartSize=1000000
 	  </pre></code>
-	  After server start, the size of the thread pool is always 0. Threads
-	  are started on demand when requests come in. The cleanup timer reduces
-	  the number of idle threads slowly by closing one thread in each interval.
-	  But the configured minimum number of threads are kept running.
+	  The configured minimum number of threads is started with the pool. In each cleanupInterval, a
+	  HttpPoolPolicy decides the size of the pool from the recent load. Missing threads are started
+	  immediately, before the next connections arrive. Surplus idle threads are closed slowly, one in each
+	  interval, without waiting for them on the thread of the listener. If all threads are busy, further
+	  threads are still started on demand up to maxThreads. The default policy is AdaptivePoolPolicy.
+	  <p>
+	  With pipelineConcurrency > 1, the pool also owns a QThreadPool with pipelineThreads threads, which
+	  services the pipelined requests of all connections, see HttpConnectionHandler.
 	  <p>
 	  For SSL support, you need an OpenSSL certificate file and a key file.
 	  Both can be created with the command
@@ -37,11 +49,20 @@ namespace qtwebapp {
 	      openssl req -x509 -nodes -days 365 -newkey rsa:2048 -keyout my.key -out my.cert
 	  </pre></code>
 	  <p>
+	  If sslAutoReload is enabled, the files are loaded again when they change, e.g. after a certificate
+	  has been renewed. New connections use the new certificate while existing connections continue.
+	  reloadSslConfig() does the same on demand.
+	  <p>
 	  Visit http://slproweb.com/products/Win32OpenSSL.html to download the Light version of OpenSSL for Windows.
 	  <p>
 	  Please note that a listener with SSL settings can only handle HTTPS protocol. To
 	  support both HTTP and HTTPS simultaneously, you need to start two listeners on different ports -
-	  one with SLL and one without SSL.
+	  one with SLL and one without SSL, or configure additional endpoints:
+	  <code><pre>
+	  endpoints=http://0.0.0.0:8080, https://0.0.0.0:8443
+	  </pre></code>
+	  All endpoints share the connection handlers of the pool, so minThreads and maxThreads apply to all
+	  of them together. An endpoint may use its own certificate, see HttpServerConfig::endpoints.
 	  @see HttpConnectionHandler for description of the readTimeout
 	  @see HttpRequest for description of config settings maxRequestSize and maxMultiPartSize
 	*/
@@ -54,15 +75,54 @@ namespace qtwebapp {
 		  Constructor.
 		  @param settings Configuration settings for the HTTP server. Must not be 0.
 		  @param requestHandler The handler that will process each received HTTP request.
+		  @param statistics Counters that are updated by the connection handlers, may be NULL
+		  @param policy Decides the size of the pool, a AdaptivePoolPolicy is used if NULL
+		  @param clientLimiter Limits of the client IP addresses, will be assigned to each Connectionhandler, may be NULL
 		  @warning The requestMapper gets deleted by the destructor of this pool
 		*/
-		HttpConnectionHandlerPool(const HttpServerConfig &cfg, HttpRequestHandler *requestHandler);
+		HttpConnectionHandlerPool(const HttpServerConfig &cfg, HttpRequestHandler *requestHandler,
+		                          HttpServerStatistics *statistics = nullptr,
+		                          const QSharedPointer<HttpPoolPolicy> &policy = QSharedPointer<HttpPoolPolicy>(),
+		                          HttpClientLimiter *clientLimiter = nullptr);
 
 		/** Destructor */
 		virtual ~HttpConnectionHandlerPool();
 
-		/** Get a free connection handler, or 0 if not available. */
-		HttpConnectionHandler *getConnectionHandler();
+		/**
+		  Get a free connection handler, or 0 if not available.
+		  @param endpoint The endpoint that accepted the connection, 0 for host and port, or 1 + the index in
+		  HttpServerConfig::endpoints. It decides the SSL configuration of the connection.
+		*/
+		HttpConnectionHandler *getConnectionHandler(int endpoint = 0);
+
+		/** Replace the policy that decides the size of the pool. This method is thread safe. */
+		void setPolicy(const QSharedPointer<HttpPoolPolicy> &policy);
+
+		/**
+		  Let all connection handlers close their connections after the current request, idle keep-alive
+		  connections are closed immediately. New connections are still accepted, but they are closed after
+		  their first request. WebSockets and event streams are closed as well.
+		  @see HttpConnectionHandler::drain()
+		*/
+		void drain();
+
+		/** Get the number of busy connection handlers */
+		int getBusyCount();
+
+	  public slots:
+
+		/**
+		  Load the SSL certificate and key files again. New connections use the new configuration,
+		  connections that have already been accepted are not affected. If the files cannot be loaded,
+		  the previous configuration is kept. This method is thread safe.
+		  @return False if SSL is not enabled or the files cannot be loaded
+		*/
+		bool reloadSslConfig();
+
+	  signals:
+
+		/** Emitted when a connection handler has become free or has been created */
+		void handlerAvailable();
 
 	  private:
 		/** Config for this pool */
@@ -71,23 +131,91 @@ namespace qtwebapp {
 		/** Will be assigned to each Connectionhandler during their creation */
 		HttpRequestHandler *requestHandler;
 
+		/** Counters of the listener, will be assigned to each Connectionhandler during their creation */
+		HttpServerStatistics *statistics;
+
+		/** Limits of the client IP addresses, will be assigned to each Connectionhandler during their creation */
+		HttpClientLimiter *clientLimiter;
+
 		/** Pool of connection handlers */
 		QList<HttpConnectionHandler *> pool;
 
+		/** Handlers that have been removed from the pool, they are deleted when their threads have finished */
+		QList<HttpConnectionHandler *> retired;
+
+		/** Decides the size of the pool */
+		QSharedPointer<HttpPoolPolicy> policy;
+
+		/** Number of connections accepted since the last clean-up */
+		int acceptedCounter;
+
+		/** Number of handlers created on demand since the last clean-up */
+		int createdCounter;
+
+		/** Whether the pool has been drained */
+		bool draining;
+
+		/** Thread that processes the events of all WebSocket connections */
+		QThread *ioThread;
+
+		/** Threads that service the pipelined requests of all connections */
+		QThreadPool pipelinePool;
+
 		/** Timer to clean-up unused connection handler */
 		QTimer cleanupTimer;
 
 		/** Used to synchronize threads */
 		QMutex mutex;
 
-		/** The SSL configuration (certificate, key and other settings) */
-		QSslConfiguration *sslConfiguration;
+		/**
+		  The SSL configuration (certificate, key and other settings) of each endpoint, shared with the connection
+		  handlers. NULL for endpoints without SSL.
+		*/
+		QList<QSharedPointer<QSslConfiguration>> sslConfigurations;
+
+		/** The SSL key file of each endpoint, empty for endpoints without SSL */
+		QStringList sslKeyFiles;
+
+		/** The SSL certificate file of each endpoint, empty for endpoints without SSL */
+		QStringList sslCertFiles;
 
-		/** Load SSL configuration */
-		void loadSslConfig();
+		/** Watches the certificate and key files if sslAutoReload is enabled */
+		QFileSystemWatcher *sslWatcher;
+
+		/** Delays reloading after the files have changed */
+		QTimer sslReloadTimer;
+
+		/**
+		  Load SSL configuration
+		  @param sslKeyFile The key file, relative to the config file
+		  @param sslCertFile The certificate file, relative to the config file
+		  @return The configuration, or a null pointer if SSL is not configured or the files cannot be loaded
+		*/
+		QSharedPointer<QSslConfiguration> loadSslConfig(const QString &sslKeyFile, const QString &sslCertFile);
+
+		/**
+		  Get a SSL configuration for new connection handlers. Their socket supports SSL if any endpoint uses SSL,
+		  the configuration is replaced for each connection.
+		*/
+		QSharedPointer<QSslConfiguration> handlerSslConfiguration() const;
+
+		/** Get the absolute path of a SSL file, relative paths are based on the directory of the config file */
+		QString sslFilePath(const QString &fileName) const;
+
+		/** Add the certificate and key files to the file system watcher */
+		void watchSslFiles();
+
+		/** Create a connection handler and add it to the pool, the caller must hold the mutex */
+		HttpConnectionHandler *createHandler();
 
 	  private slots:
 
+		/** Received from the file system watcher when the certificate or key file has changed */
+		void sslFileChanged();
+
+		/** Received from the reload timer after the certificate or key file has changed */
+		void sslReloadTimeout();
+
 		/** Received from the clean-up timer.  */
 		void cleanup();
 	};
@@ -0,0 +1,146 @@
+#include "httpfilereader.h"
+
+#include <QElapsedTimer>
+
+#ifdef CMAKE_QTWEBAPP_IO_URING
+#include <errno.h>
+#include <liburing.h>
+
+/** The io_uring instance of a thread, created when the thread reads its first file */
+struct ThreadRing {
+	io_uring ring;
+	bool supported;
+
+	ThreadRing() {
+		// Old kernels or a disabled io_uring are detected here
+		supported = io_uring_queue_init(4, &ring, 0) == 0;
+		if (!supported) {
+			qDebug("HttpFileReader: io_uring is not supported, using read()");
+		}
+	}
+
+	~ThreadRing() {
+		if (supported) {
+			io_uring_queue_exit(&ring);
+		}
+	}
+};
+
+static thread_local ThreadRing threadRing;
+#endif
+
+using namespace qtwebapp;
+
+HttpFileReader::HttpFileReader(QFile &file, qint64 size, int blockSize, HttpServerStatistics *statistics)
+    : file(file), blockSize(blockSize), statistics(statistics) {
+	position = file.pos();
+	end = position + size;
+	current = 0;
+	pending = false;
+	seekNeeded = false;
+#ifdef CMAKE_QTWEBAPP_IO_URING
+	// Files in Qt resources have no descriptor
+	ring = file.handle() >= 0 && threadRing.supported;
+#else
+	ring = false;
+#endif
+}
+
+HttpFileReader::~HttpFileReader() {
+	// The kernel must not write into the buffer after it has been released
+	if (pending) {
+		complete();
+	}
+	if (seekNeeded) {
+		file.seek(position);
+	}
+}
+
+QByteArray HttpFileReader::read() {
+	if (!statistics) {
+		return readBlock();
+	}
+	QElapsedTimer timer;
+	timer.start();
+	QByteArray block = readBlock();
+	statistics->fileReadWait.fetchAndAddOrdered(timer.nsecsElapsed() / 1000);
+	statistics->fileReadBytes.fetchAndAddOrdered(block.size());
+	return block;
+}
+
+QByteArray HttpFileReader::readBlock() {
+	if (position >= end) {
+		return QByteArray();
+	}
+	if (ring) {
+		if (pending || submit()) {
+			bool first = !seekNeeded;
+			seekNeeded = true;
+			int result = complete();
+			if (result > 0) {
+				buffers[current].resize(result);
+				QByteArray block = buffers[current];
+				position += result;
+				// Read ahead into the other buffer while the caller sends this block. If the caller still
+				// holds the other block, it is detached by the next submit().
+				current = 1 - current;
+				if (position < end) {
+					submit();
+				}
+				return block;
+			}
+#ifdef CMAKE_QTWEBAPP_IO_URING
+			// Kernels before 5.6 do not support reads with io_uring
+			if (!first || (result != -EINVAL && result != -EOPNOTSUPP)) {
+				return QByteArray();
+			}
+#else
+			Q_UNUSED(first)
+#endif
+		}
+		ring = false;
+		file.seek(position);
+		seekNeeded = false;
+	}
+	QByteArray block = file.read(qMin(end - position, qint64(blockSize)));
+	position += block.size();
+	return block;
+}
+
+bool HttpFileReader::submit() {
+#ifdef CMAKE_QTWEBAPP_IO_URING
+	io_uring_sqe *sqe = io_uring_get_sqe(&threadRing.ring);
+	if (!sqe) {
+		return false;
+	}
+	QByteArray &buffer = buffers[current];
+	int size = int(qMin(end - position, qint64(blockSize)));
+	buffer.resize(size);
+	io_uring_prep_read(sqe, file.handle(), buffer.data(), unsigned(size), quint64(position));
+	if (io_uring_submit(&threadRing.ring) != 1) {
+		return false;
+	}
+	pending = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+int HttpFileReader::complete() {
+	pending = false;
+#ifdef CMAKE_QTWEBAPP_IO_URING
+	io_uring_cqe *cqe;
+	int result;
+	do {
+		result = io_uring_wait_cqe(&threadRing.ring, &cqe);
+	} while (result == -EINTR);
+	if (result == 0) {
+		result = cqe->res;
+		io_uring_cqe_seen(&threadRing.ring, cqe);
+	}
+	return result;
+#else
+	return -1;
+#endif
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "httpserverstatistics.h"
+#include "qtwebappglobal.h"
+
+#include <QByteArray>
+#include <QFile>
+
+namespace qtwebapp {
+
+	/**
+	  Reads a file in blocks for sending it, when it cannot be sent with sendfile(): on TLS and HTTP/2
+	  connections, for pipelined requests and on other systems than Linux. If QtWebApp has been built with
+	  io_uring support on Linux (cmake -DQTWEBAPP_IO_URING=ON, requires liburing), the kernel reads the
+	  next block while the caller sends the current one. Otherwise, or if the kernel does not support
+	  io_uring, the blocks are read with QFile::read().
+	  <p>
+	  Only these file reads use io_uring, the connections are still served by QTcpSocket. The time that
+	  the caller waits for the blocks is added to HttpServerStatistics::fileReadWait.
+	  <p>
+	  Each thread has its own io_uring instance, so a thread must use only one reader at a time.
+	  When the reader is deleted, the position of the file is after the last returned block.
+	*/
+	class QTWEBAPP_EXPORT HttpFileReader {
+		Q_DISABLE_COPY(HttpFileReader)
+
+	  public:
+		/**
+		  Constructor.
+		  @param file A file that has been opened for reading, it is read from its current position
+		  @param size The number of bytes to read
+		  @param blockSize The maximum size of the blocks
+		  @param statistics Receives the number of bytes and the waiting time, may be NULL
+		*/
+		HttpFileReader(QFile &file, qint64 size, int blockSize = 65536, HttpServerStatistics *statistics = nullptr);
+
+		/** Destructor, waits for a read in progress */
+		virtual ~HttpFileReader();
+
+		/** Get the next block, or an empty array at the end or on error */
+		QByteArray read();
+
+	  private:
+		/** The file */
+		QFile &file;
+
+		/** Position of the next block */
+		qint64 position;
+
+		/** Position after the last block */
+		qint64 end;
+
+		/** Maximum size of a block */
+		int blockSize;
+
+		/** The blocks, one is read by the kernel while the other is sent */
+		QByteArray buffers[2];
+
+		/** Index of the buffer that receives the next block */
+		int current;
+
+		/** Whether a read has been submitted and not completed */
+		bool pending;
+
+		/** Whether io_uring is used */
+		bool ring;
+
+		/** Whether the file position must be set, because io_uring does not move it */
+		bool seekNeeded;
+
+		/** Receives the number of bytes and the waiting time, or nullptr */
+		HttpServerStatistics *statistics;
+
+		/** Get the next block, without measuring the time */
+		QByteArray readBlock();
+
+		/** Submit the read of the next block to io_uring */
+		bool submit();
+
+		/** Wait for the submitted read, returns the number of bytes or a negative error code */
+		int complete();
+	};
+
+} // namespace qtwebapp
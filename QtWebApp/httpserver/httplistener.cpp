@@ -8,72 +8,621 @@
 #include "httpconnectionhandler.h"
 #include "httpconnectionhandlerpool.h"
 
+#include <QAtomicInt>
 #include <QCoreApplication>
+#include <QFile>
+#include <QLocalSocket>
+
+#include <math.h>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 using namespace qtwebapp;
 
+#ifdef Q_OS_UNIX
+
+/** Get the next listening socket passed by systemd, or -1. Each listener takes one socket. */
+static qintptr systemdListeningSocket() {
+	// Listeners may be started from different threads
+	static QAtomicInt next;
+	if (qgetenv("LISTEN_PID").toLongLong() != getpid()) {
+		return -1;
+	}
+	int index = next.fetchAndAddOrdered(1);
+	if (index >= qgetenv("LISTEN_FDS").toInt()) {
+		return -1;
+	}
+	// The sockets start at SD_LISTEN_FDS_START
+	return 3 + index;
+}
+
+/** Receive the listening socket from the previous process over a local socket, or -1 if there is none */
+static qintptr receiveListeningSocket(const QString &path) {
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	QByteArray encodedPath = QFile::encodeName(path);
+	if (encodedPath.size() >= int(sizeof(address.sun_path))) {
+		qWarning("HttpListener: handoffSocket path is too long");
+		return -1;
+	}
+	memcpy(address.sun_path, encodedPath.constData(), encodedPath.size());
+	int local = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (local < 0) {
+		return -1;
+	}
+	if (::connect(local, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+		::close(local);
+		return -1;
+	}
+	// Do not wait forever for a previous process that hangs
+	timeval timeout = {5, 0};
+	setsockopt(local, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	char data;
+	iovec iov = {&data, 1};
+	union {
+		cmsghdr header;
+		char buffer[CMSG_SPACE(sizeof(int))];
+	} control;
+	msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control.buffer;
+	message.msg_controllen = sizeof(control.buffer);
+	qintptr listeningSocket = -1;
+	if (recvmsg(local, &message, 0) == 1) {
+		cmsghdr *header = CMSG_FIRSTHDR(&message);
+		if (header && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+			int descriptor;
+			memcpy(&descriptor, CMSG_DATA(header), sizeof(int));
+			listeningSocket = descriptor;
+		}
+	}
+	// The previous process closes the connection after it removed its local socket file
+	while (recv(local, &data, 1, 0) > 0) {
+	}
+	::close(local);
+	return listeningSocket;
+}
+
+/** Send the listening socket to the next process over a connected local socket */
+static bool sendListeningSocket(qintptr local, qintptr listeningSocket) {
+	char data = 'L';
+	iovec iov = {&data, 1};
+	union {
+		cmsghdr header;
+		char buffer[CMSG_SPACE(sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof(control));
+	msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control.buffer;
+	message.msg_controllen = sizeof(control.buffer);
+	cmsghdr *header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(int));
+	int descriptor = int(listeningSocket);
+	memcpy(CMSG_DATA(header), &descriptor, sizeof(int));
+	return sendmsg(int(local), &message, 0) == 1;
+}
+
+/** Set an option of a socket, with a warning if it fails */
+static void setOption(int socket, int level, int option, int value, const char *name) {
+	if (setsockopt(socket, level, option, &value, sizeof(value)) != 0) {
+		qWarning("HttpListener: Cannot set %s: %s", name, strerror(errno));
+	}
+}
+
+#endif // Q_OS_UNIX
+
+/** Apply the configured options to a listening socket, the accepted connections inherit them */
+static void setListenOptions(qintptr listeningSocket, const HttpServerConfig &cfg) {
+#ifdef Q_OS_UNIX
+	int socket = int(listeningSocket);
+	// Listening again changes the backlog, also of an inherited socket
+	if (cfg.listenBacklog > 0 && ::listen(socket, cfg.listenBacklog) != 0) {
+		qWarning("HttpListener: Cannot set listenBacklog: %s", strerror(errno));
+	}
+	if (cfg.socketSendBufferSize > 0) {
+		setOption(socket, SOL_SOCKET, SO_SNDBUF, cfg.socketSendBufferSize, "socketSendBufferSize");
+	}
+	if (cfg.socketReceiveBufferSize > 0) {
+		setOption(socket, SOL_SOCKET, SO_RCVBUF, cfg.socketReceiveBufferSize, "socketReceiveBufferSize");
+	}
+#ifdef Q_OS_LINUX
+	if (cfg.tcpDeferAccept > 0) {
+		setOption(socket, IPPROTO_TCP, TCP_DEFER_ACCEPT, cfg.tcpDeferAccept, "tcpDeferAccept");
+	}
+	if (cfg.tcpFastOpen > 0) {
+		setOption(socket, IPPROTO_TCP, TCP_FASTOPEN, cfg.tcpFastOpen, "tcpFastOpen");
+	}
+#else
+	if (cfg.tcpDeferAccept > 0 || cfg.tcpFastOpen > 0) {
+		qWarning("HttpListener: tcpDeferAccept and tcpFastOpen are not supported on this platform");
+	}
+#endif
+#else
+	Q_UNUSED(listeningSocket)
+	if (cfg.listenBacklog > 0 || cfg.socketSendBufferSize > 0 || cfg.socketReceiveBufferSize > 0 ||
+	    cfg.tcpDeferAccept > 0 || cfg.tcpFastOpen > 0) {
+		qWarning("HttpListener: Socket options are not supported on this platform");
+	}
+#endif
+}
+
+HttpLocalServer::HttpLocalServer(HttpListener *listener) : QLocalServer(listener), listener(listener) {}
+
+void HttpLocalServer::incomingConnection(quintptr socketDescriptor) {
+	// QTcpSocket can use the descriptor of a Unix domain socket, so the connection handlers need no changes
+	listener->acceptConnection(qintptr(socketDescriptor), 0);
+}
+
+HttpEndpointServer::HttpEndpointServer(HttpListener *listener, int endpoint)
+    : QTcpServer(listener), listener(listener), endpoint(endpoint) {}
+
+void HttpEndpointServer::incomingConnection(qintptr socketDescriptor) {
+	listener->acceptConnection(socketDescriptor, endpoint);
+}
+
 HttpListener::HttpListener(const HttpServerConfig &cfg, HttpRequestHandler *requestHandler, QObject *parent)
-    : QTcpServer(parent), cfg(cfg) {
+    : QTcpServer(parent), cfg(cfg), clientLimiter(cfg) {
 	Q_ASSERT(requestHandler != nullptr);
 	pool = nullptr;
+	handoffServer = nullptr;
+	localServer = nullptr;
+	draining = false;
+	drainTimer.setSingleShot(true);
+	connect(&drainTimer, SIGNAL(timeout()), SLOT(finishDrain()));
 	this->requestHandler = requestHandler;
 	// Reqister type of socketDescriptor for signal/slot handling
 	qRegisterMetaType<qintptr>("qintptr");
+	clock.start();
+	firstAboveTime = 0;
+	dropNext = 0;
+	dropCount = 0;
+	dropping = false;
+	queueTimer.setSingleShot(true);
+	connect(&queueTimer, SIGNAL(timeout()), SLOT(expirePending()));
+	lagProbeTime = 0;
+	lagTimer.setTimerType(Qt::PreciseTimer);
+	lagTimer.setInterval(100);
+	connect(&lagTimer, SIGNAL(timeout()), SLOT(measureEventLoopLag()));
+	acceptThread = nullptr;
+	ownerThread = thread();
+	if (cfg.acceptThread) {
+		if (parent) {
+			qWarning("HttpListener: acceptThread requires a listener without parent");
+		} else {
+			acceptThread = new QThread();
+			acceptThread->setObjectName("HttpListener");
+			// The timers are members, not children, so they are moved separately
+			moveToThread(acceptThread);
+			queueTimer.moveToThread(acceptThread);
+			drainTimer.moveToThread(acceptThread);
+			lagTimer.moveToThread(acceptThread);
+			acceptThread->start();
+		}
+	}
 	// Start listening
 	listen();
 }
 
 HttpListener::~HttpListener() {
+	if (acceptThread) {
+		QMetaObject::invokeMethod(this, "stopAcceptThread", Qt::BlockingQueuedConnection);
+		acceptThread->quit();
+		acceptThread->wait();
+		delete acceptThread;
+	}
 	close();
 #ifdef CMAKE_DEBUG
 	qDebug("HttpListener: destroyed");
 #endif
 }
 
+void HttpListener::stopAcceptThread() {
+	close();
+	moveToThread(ownerThread);
+	queueTimer.moveToThread(ownerThread);
+	drainTimer.moveToThread(ownerThread);
+	lagTimer.moveToThread(ownerThread);
+}
+
 void HttpListener::listen() {
+	// The sockets must be created by the thread of the listener
+	if (QThread::currentThread() != thread()) {
+		QMetaObject::invokeMethod(this, "listen", Qt::BlockingQueuedConnection);
+		return;
+	}
+	lagProbeTime = clock.elapsed();
+	lagTimer.start();
 	if (!pool) {
-		pool = new HttpConnectionHandlerPool(cfg, requestHandler);
+		pool = new HttpConnectionHandlerPool(cfg, requestHandler, &statistics, poolPolicy, &clientLimiter);
+		connect(pool, SIGNAL(handlerAvailable()), SLOT(dispatchPending()));
+	}
+	draining = false;
+	if (!cfg.unixSocket.isEmpty()) {
+		if (!localServer) {
+			localServer = new HttpLocalServer(this);
+		}
+		// The file of a previous process would prevent listening
+		QLocalServer::removeServer(cfg.unixSocket);
+		if (!localServer->listen(cfg.unixSocket)) {
+			qCritical("HttpListener: Cannot listen on %s: %s", qPrintable(cfg.unixSocket),
+			          qPrintable(localServer->errorString()));
+		} else {
+			qDebug("HttpListener: Listening on %s", qPrintable(cfg.unixSocket));
+		}
+		listenEndpoints();
+		return;
+	}
+	qintptr inheritedSocket = inheritSocket();
+	if (inheritedSocket >= 0) {
+		if (!setSocketDescriptor(inheritedSocket)) {
+			qCritical("HttpListener: Cannot use the inherited socket: %s", qPrintable(errorString()));
+		}
+	} else {
+		QTcpServer::listen(cfg.host, cfg.port);
 	}
-	QTcpServer::listen(cfg.host, cfg.port);
 	if (!isListening()) {
 		qCritical("HttpListener: Cannot bind on port %i: %s", cfg.port, qPrintable(errorString()));
 	} else {
 		qDebug("HttpListener: Listening on port %i", serverPort());
+		setListenOptions(socketDescriptor(), cfg);
+		startHandoffServer();
+	}
+	listenEndpoints();
+}
+
+void HttpListener::listenEndpoints() {
+	for (int i = 0; i < cfg.endpoints.size(); i++) {
+		if (endpointServers.size() <= i) {
+			endpointServers.append(new HttpEndpointServer(this, i + 1));
+		}
+		const HttpEndpointConfig &endpoint = cfg.endpoints.at(i);
+		if (!endpointServers.at(i)->listen(endpoint.host, endpoint.port)) {
+			qCritical("HttpListener: Cannot bind on port %i: %s", endpoint.port,
+			          qPrintable(endpointServers.at(i)->errorString()));
+		} else {
+			qDebug("HttpListener: Listening on port %i%s", endpoint.port, endpoint.ssl ? " with SSL" : "");
+			setListenOptions(endpointServers.at(i)->socketDescriptor(), cfg);
+		}
+	}
+}
+
+qintptr HttpListener::inheritSocket() {
+#ifdef Q_OS_UNIX
+	qintptr inheritedSocket = -1;
+	if ((cfg.systemdSocket || !cfg.handoffSocket.isEmpty()) && !cfg.endpoints.isEmpty()) {
+		// Only the main listening socket would be passed, the endpoints could not be bound then
+		qWarning("HttpListener: systemdSocket and handoffSocket are not supported with endpoints");
+	} else if (cfg.systemdSocket) {
+		inheritedSocket = systemdListeningSocket();
+		if (inheritedSocket < 0) {
+			qWarning("HttpListener: No socket passed by systemd");
+		}
+	} else if (!cfg.handoffSocket.isEmpty()) {
+		inheritedSocket = receiveListeningSocket(cfg.handoffSocket);
+	}
+	if (inheritedSocket >= 0) {
+		qDebug("HttpListener: Using inherited listening socket %i", int(inheritedSocket));
+	}
+	return inheritedSocket;
+#else
+	if (cfg.systemdSocket || !cfg.handoffSocket.isEmpty()) {
+		qWarning("HttpListener: Inheriting the listening socket is not supported on this platform");
+	}
+	return -1;
+#endif
+}
+
+void HttpListener::startHandoffServer() {
+#ifdef Q_OS_UNIX
+	if (cfg.handoffSocket.isEmpty() || !cfg.endpoints.isEmpty()) {
+		return;
+	}
+	if (!handoffServer) {
+		handoffServer = new QLocalServer(this);
+		connect(handoffServer, SIGNAL(newConnection()), SLOT(handOver()));
 	}
+	// The file of the previous process is stale after the handoff, or after a crash
+	QLocalServer::removeServer(cfg.handoffSocket);
+	if (!handoffServer->listen(cfg.handoffSocket)) {
+		qWarning("HttpListener: Cannot listen on handoffSocket %s: %s", qPrintable(cfg.handoffSocket),
+		         qPrintable(handoffServer->errorString()));
+	}
+#endif
+}
+
+void HttpListener::handOver() {
+#ifdef Q_OS_UNIX
+	QLocalSocket *local = handoffServer->nextPendingConnection();
+	if (!local) {
+		return;
+	}
+	bool sent = isListening() && sendListeningSocket(local->socketDescriptor(), socketDescriptor());
+	// Closing the server removes its file. This must happen before the connection is closed, because
+	// the next process creates its own file then.
+	handoffServer->close();
+	local->abort();
+	local->deleteLater();
+	if (sent) {
+		qDebug("HttpListener: Listening socket passed to the next process");
+		drain(cfg.drainTimeout);
+	} else {
+		qWarning("HttpListener: Cannot pass the listening socket to the next process");
+		startHandoffServer();
+	}
+#endif
+}
+
+void HttpListener::drain(int timeout) {
+	if (QThread::currentThread() != thread()) {
+		QMetaObject::invokeMethod(this, "drain", Qt::BlockingQueuedConnection, Q_ARG(int, timeout));
+		return;
+	}
+	if (!pool || draining) {
+		return;
+	}
+	qDebug("HttpListener: draining");
+	QTcpServer::close();
+	if (localServer) {
+		localServer->close();
+	}
+	foreach (HttpEndpointServer *endpointServer, endpointServers) {
+		endpointServer->close();
+	}
+	if (handoffServer && handoffServer->isListening()) {
+		handoffServer->close();
+	}
+	draining = true;
+	pool->drain();
+	drainTimer.start(timeout);
+	checkDrained();
+}
+
+void HttpListener::checkDrained() {
+	// The pool is deleted later, because this may be called by a signal of the pool
+	if (draining && pendingConnections.isEmpty() && pool->getBusyCount() == 0) {
+		QMetaObject::invokeMethod(this, "finishDrain", Qt::QueuedConnection);
+	}
+}
+
+void HttpListener::finishDrain() {
+	if (!draining) {
+		return;
+	}
+	if (drainTimer.isActive()) {
+		drainTimer.stop();
+	} else {
+		qWarning("HttpListener: drain timeout, closing the remaining connections");
+	}
+	draining = false;
+	close();
+	emit drained();
 }
 
 void HttpListener::close() {
+	if (QThread::currentThread() != thread()) {
+		QMetaObject::invokeMethod(this, "close", Qt::BlockingQueuedConnection);
+		return;
+	}
+	lagTimer.stop();
 	QTcpServer::close();
+	if (localServer) {
+		localServer->close();
+	}
+	foreach (HttpEndpointServer *endpointServer, endpointServers) {
+		endpointServer->close();
+	}
+	draining = false;
+	drainTimer.stop();
 #ifdef CMAKE_DEBUG
 	qDebug("HttpListener: closed");
 #endif
+	clearPendingConnections();
 	if (pool) {
 		delete pool;
 		pool = nullptr;
 	}
 }
 
+bool HttpListener::reloadSslConfig() {
+	return pool && pool->reloadSslConfig();
+}
+
+const HttpServerStatistics &HttpListener::getStatistics() const {
+	return statistics;
+}
+
+void HttpListener::setPoolPolicy(HttpPoolPolicy *policy) {
+	poolPolicy = QSharedPointer<HttpPoolPolicy>(policy);
+	if (pool) {
+		pool->setPolicy(poolPolicy);
+	}
+}
+
+void HttpListener::measureEventLoopLag() {
+	// A timer that fires late shows how long the event loop was blocked. This is not the time of a single
+	// accept, but a connection that arrives meanwhile waits up to this long.
+	qint64 now = clock.elapsed();
+	qint64 lag = qMax(qint64(0), now - lagProbeTime - lagTimer.interval());
+	lagProbeTime = now;
+	statistics.eventLoopLag.storeRelease(lag);
+	if (lag > statistics.maxEventLoopLag.loadAcquire()) {
+		statistics.maxEventLoopLag.storeRelease(lag);
+	}
+}
+
 void HttpListener::incomingConnection(qintptr socketDescriptor) {
+	acceptConnection(socketDescriptor, 0);
+}
+
+void HttpListener::acceptConnection(qintptr socketDescriptor, int endpoint) {
 #ifdef SUPERVERBOSE
-	qDebug("HttpListener: New connection");
+	qDebug("HttpListener: New connection on endpoint %i", endpoint);
 #endif
 
+	// Count the connection of the client, before it occupies a connection handler or a place in the queue
+	QHostAddress peerAddress;
+	if (clientLimiter.isEnabled()) {
+		peerAddress = HttpClientLimiter::peerAddress(socketDescriptor);
+		if (!clientLimiter.addConnection(peerAddress)) {
+			qWarning("HttpListener: Too many connections from %s", qPrintable(peerAddress.toString()));
+			statistics.limitedConnections.ref();
+			reject(socketDescriptor, 429);
+			return;
+		}
+	}
+
+	// Connections that are already waiting come first
 	HttpConnectionHandler *freeHandler = nullptr;
-	if (pool) {
-		freeHandler = pool->getConnectionHandler();
+	if (pool && pendingConnections.isEmpty()) {
+		freeHandler = pool->getConnectionHandler(endpoint);
 	}
 
-	// Let the handler process the new connection.
 	if (freeHandler) {
-		// The descriptor is passed via event queue because the handler lives in another thread
-		QMetaObject::invokeMethod(freeHandler, "handleConnection", Qt::QueuedConnection, Q_ARG(qintptr, socketDescriptor));
+		dispatch(freeHandler, socketDescriptor);
+	} else if (pool && pendingConnections.size() < cfg.acceptQueueSize) {
+		// Wait for a free handler, the pool sends handlerAvailable()
+		PendingConnection pending;
+		pending.socketDescriptor = socketDescriptor;
+		pending.endpoint = endpoint;
+		pending.peerAddress = peerAddress;
+		pending.enqueueTime = clock.elapsed();
+		pendingConnections.enqueue(pending);
+		statistics.queuedConnections.ref();
+		statistics.acceptQueueLength.storeRelease(pendingConnections.size());
+		if (!queueTimer.isActive()) {
+			queueTimer.start(cfg.acceptQueueTimeout);
+		}
 	} else {
-		// Reject the connection
 		qWarning("HttpListener: Too many incoming connections");
-		QTcpSocket *socket = new QTcpSocket(this);
-		socket->setSocketDescriptor(socketDescriptor);
-		connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
-		socket->write("HTTP/1.1 503 too many connections\r\nConnection: close\r\n\r\nToo many connections\r\n");
-		socket->disconnectFromHost();
+		if (clientLimiter.isEnabled()) {
+			clientLimiter.removeConnection(peerAddress);
+		}
+		reject(socketDescriptor);
+	}
+}
+
+void HttpListener::dispatch(HttpConnectionHandler *handler, qintptr socketDescriptor) {
+	// The descriptor is passed via event queue because the handler lives in another thread
+	QMetaObject::invokeMethod(handler, "handleConnection", Qt::QueuedConnection, Q_ARG(qintptr, socketDescriptor));
+}
+
+void HttpListener::reject(qintptr socketDescriptor, int status) {
+	if (status == 503) {
+		statistics.rejectedConnections.ref();
+	}
+	QTcpSocket *socket = new QTcpSocket(this);
+	socket->setSocketDescriptor(socketDescriptor);
+	connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+	QByteArray response(status == 429 ? "HTTP/1.1 429 Too Many Requests\r\nRetry-After: "
+	                                  : "HTTP/1.1 503 Service Unavailable\r\nRetry-After: ");
+	response.append(QByteArray::number(cfg.retryAfter));
+	response.append("\r\nConnection: close\r\nContent-Length: 22\r\n\r\nToo many connections\r\n");
+	socket->write(response);
+	socket->disconnectFromHost();
+	// Do not keep the socket of a client that does not read the response
+	QTimer::singleShot(cfg.writeTimeout, socket, SLOT(abort()));
+}
+
+void HttpListener::rejectPending(const PendingConnection &pending) {
+	if (clientLimiter.isEnabled()) {
+		clientLimiter.removeConnection(pending.peerAddress);
+	}
+	reject(pending.socketDescriptor);
+}
+
+bool HttpListener::shed(qint64 waitTime, qint64 now) {
+	// The waiting time must stay above the target for a whole interval, short bursts are absorbed
+	bool overloaded = false;
+	if (waitTime < cfg.acceptQueueTarget || pendingConnections.isEmpty()) {
+		firstAboveTime = 0;
+	} else if (firstAboveTime == 0) {
+		firstAboveTime = now + cfg.acceptQueueInterval;
+	} else if (now >= firstAboveTime) {
+		overloaded = true;
+	}
+
+	if (dropping) {
+		if (!overloaded) {
+			dropping = false;
+		} else if (now >= dropNext) {
+			// Reject more often while the overload persists
+			dropCount++;
+			dropNext = now + qint64(cfg.acceptQueueInterval / sqrt(double(dropCount)));
+			return true;
+		}
+		return false;
+	}
+	if (overloaded) {
+		dropping = true;
+		// Continue with the previous rate if the last overload ended recently
+		dropCount = (dropCount > 2 && now - dropNext < 8 * cfg.acceptQueueInterval) ? dropCount - 2 : 1;
+		dropNext = now + qint64(cfg.acceptQueueInterval / sqrt(double(dropCount)));
+		return true;
+	}
+	return false;
+}
+
+void HttpListener::dispatchPending() {
+	while (pool && !pendingConnections.isEmpty()) {
+		PendingConnection pending = pendingConnections.dequeue();
+		qint64 now = clock.elapsed();
+		qint64 waitTime = now - pending.enqueueTime;
+		if (waitTime >= cfg.acceptQueueTimeout || shed(waitTime, now)) {
+			rejectPending(pending);
+			if (waitTime < cfg.acceptQueueTimeout) {
+				statistics.shedConnections.ref();
+			}
+			continue;
+		}
+		HttpConnectionHandler *freeHandler = pool->getConnectionHandler(pending.endpoint);
+		if (!freeHandler) {
+			pendingConnections.prepend(pending);
+			break;
+		}
+		statistics.queueTime.fetchAndAddRelaxed(waitTime);
+		if (waitTime > statistics.maxQueueTime.loadAcquire()) {
+			statistics.maxQueueTime.storeRelease(waitTime);
+		}
+		dispatch(freeHandler, pending.socketDescriptor);
+	}
+	statistics.acceptQueueLength.storeRelease(pendingConnections.size());
+	checkDrained();
+}
+
+void HttpListener::expirePending() {
+	qint64 now = clock.elapsed();
+	while (!pendingConnections.isEmpty() && now - pendingConnections.head().enqueueTime >= cfg.acceptQueueTimeout) {
+		qWarning("HttpListener: Connection waited too long for a free connection handler");
+		rejectPending(pendingConnections.dequeue());
+	}
+	statistics.acceptQueueLength.storeRelease(pendingConnections.size());
+	if (!pendingConnections.isEmpty()) {
+		queueTimer.start(int(pendingConnections.head().enqueueTime + cfg.acceptQueueTimeout - now));
+	}
+}
+
+void HttpListener::clearPendingConnections() {
+	queueTimer.stop();
+	while (!pendingConnections.isEmpty()) {
+		rejectPending(pendingConnections.dequeue());
 	}
+	statistics.acceptQueueLength.storeRelease(0);
 }
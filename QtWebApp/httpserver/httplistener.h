@@ -5,17 +5,64 @@
 
 #pragma once
 
+#include "httpclientlimiter.h"
 #include "httpconnectionhandler.h"
 #include "httpconnectionhandlerpool.h"
 #include "httprequesthandler.h"
 #include "httpserverconfig.h"
+#include "httpserverstatistics.h"
 #include "qtwebappglobal.h"
 
-#include <QBasicTimer>
+#include <QElapsedTimer>
+#include <QLocalServer>
+#include <QQueue>
 #include <QTcpServer>
+#include <QThread>
+#include <QTimer>
 
 namespace qtwebapp {
 
+	class HttpListener;
+
+	/** Accepts connections on a Unix domain socket and passes them to a HttpListener */
+	class HttpLocalServer : public QLocalServer {
+		Q_DISABLE_COPY(HttpLocalServer)
+	  public:
+		/** Constructor */
+		HttpLocalServer(HttpListener *listener);
+
+	  protected:
+		/** Passes the new connection to the listener */
+		void incomingConnection(quintptr socketDescriptor);
+
+	  private:
+		/** The listener that processes the connections */
+		HttpListener *listener;
+	};
+
+	/** Accepts connections on an additional endpoint and passes them to a HttpListener */
+	class HttpEndpointServer : public QTcpServer {
+		Q_DISABLE_COPY(HttpEndpointServer)
+	  public:
+		/**
+		  Constructor.
+		  @param listener The listener that processes the connections
+		  @param endpoint 1 + the index of the endpoint in HttpServerConfig::endpoints
+		*/
+		HttpEndpointServer(HttpListener *listener, int endpoint);
+
+	  protected:
+		/** Passes the new connection to the listener */
+		void incomingConnection(qintptr socketDescriptor);
+
+	  private:
+		/** The listener that processes the connections */
+		HttpListener *listener;
+
+		/** The number of the endpoint */
+		int endpoint;
+	};
+
 	/**
 	  Listens for incoming TCP connections and and passes all incoming HTTP requests to your implementation of
 	  HttpRequestHandler, which processes the request and generates the response (usually a HTML document). <p> Example for
@@ -30,6 +77,55 @@ namespace qtwebapp {
 	  The optional host parameter binds the listener to one network interface.
 	  The listener handles all network interfaces if no host is configured.
 	  The port number specifies the incoming TCP port that this listener listens to.
+	  <p>
+	  If unixSocket is configured, the listener accepts connections on that Unix domain socket instead, e.g.
+	  behind a reverse proxy on the same machine:
+	  <code><pre>
+	  unixSocket=/run/myapp/http.sock
+	  </pre></code>
+	  The connections are processed by the same connection handlers. Their peer address is reported as
+	  QHostAddress::LocalHost.
+	  <p>
+	  The listener can accept connections on further addresses and ports, e.g. HTTP and HTTPS together,
+	  see HttpServerConfig::endpoints. All endpoints share the connection pool and the accept queue.
+	  <p>
+	  When all connection handlers are busy, up to acceptQueueSize connections wait for a free handler, but
+	  not longer than acceptQueueTimeout. If the waiting time stays above acceptQueueTarget for longer than
+	  acceptQueueInterval, the server is overloaded and waiting connections are rejected at an increasing
+	  rate until the waiting time is short again (CoDel). Rejected connections receive the status 503 with
+	  a Retry-After header.
+	  <p>
+	  The concurrent connections and the request rate of each client IP address can be limited, see
+	  HttpClientLimiter. Connections above maxConnectionsPerClient are rejected with the status 429 before
+	  they occupy a connection handler.
+	  <p>
+	  drain() shuts the listener down gracefully: no new connections are accepted, requests in progress
+	  are completed with Connection: close and idle keep-alive connections are closed. For a restart
+	  without refused connections, the listening socket can be passed to the new process of the server,
+	  either by systemd (systemdSocket=true with a .socket unit) or by the previous process
+	  (handoffSocket=/run/myapp/handoff.sock). In the latter case, each process offers its listening socket
+	  on the local socket. A new process receives it on start, and the previous process is drained.
+	  Both are only supported on Unix, and not together with endpoints, because only the main listening
+	  socket is passed.
+	  <p>
+	  The listening sockets can be tuned, the connections inherit the options:
+	  <code><pre>
+	  listenBacklog=1024
+	  tcpDeferAccept=5
+	  tcpFastOpen=256
+	  socketSendBufferSize=256K
+	  socketReceiveBufferSize=64K
+	  tcpNoDelay=true
+	  </pre></code>
+	  tcpDeferAccept and tcpFastOpen are only supported on Linux, the other options on Unix. tcpNoDelay is
+	  set on each connection.
+	  <p>
+	  By default, connections are accepted by the event loop of the thread that created the listener, usually
+	  the main thread. A busy main thread delays new connections then. With acceptThread=true, the listener
+	  moves into a thread of its own, which only accepts and dispatches connections. The listener must be
+	  created without parent then, and must be deleted by the thread that created it. Its signals are emitted
+	  by the accept thread. Each time the listening socket becomes readable, all waiting connections are
+	  accepted at once. How late the accepting event loop runs is reported in HttpServerStatistics::eventLoopLag.
 	  @see HttpConnectionHandlerPool for description of config settings minThreads, maxThreads, cleanupInterval and ssl
 	  settings
 	  @see HttpConnectionHandler for description of the readTimeout
@@ -39,6 +135,9 @@ namespace qtwebapp {
 	class QTWEBAPP_EXPORT HttpListener : public QTcpServer {
 		Q_OBJECT
 		Q_DISABLE_COPY(HttpListener)
+		friend class HttpLocalServer;
+		friend class HttpEndpointServer;
+
 	  public:
 		/**
 		  Constructor.
@@ -56,13 +155,35 @@ namespace qtwebapp {
 		/**
 		  Restart listeing after close().
 		*/
-		void listen();
+		Q_INVOKABLE void listen();
 
 		/**
 		 Closes the listener, waits until all pending requests are processed,
 		 then closes the connection pool.
 		*/
-		void close();
+		Q_INVOKABLE void close();
+
+		/**
+		  Stop accepting connections and close the connection pool after the requests in progress have been
+		  processed. Idle keep-alive connections are closed immediately. Emits drained() when finished.
+		  @param timeout Maximum time to wait in milliseconds, the remaining connections are closed then
+		*/
+		Q_INVOKABLE void drain(int timeout);
+
+		/**
+		  Load the SSL certificate and key files again without interrupting existing connections.
+		  @return False if SSL is not enabled or the files cannot be loaded
+		*/
+		bool reloadSslConfig();
+
+		/** Get the counters of this listener. They are kept when the listener is closed and restarted. */
+		const HttpServerStatistics &getStatistics() const;
+
+		/**
+		  Replace the policy that decides the number of connection handlers, see HttpPoolPolicy.
+		  The listener takes ownership of the policy. It is kept when the listener is closed and restarted.
+		*/
+		void setPoolPolicy(HttpPoolPolicy *policy);
 
 	  protected:
 		/** Serves new incoming connection requests */
@@ -78,8 +199,134 @@ namespace qtwebapp {
 		/** Pool of connection handlers */
 		HttpConnectionHandlerPool *pool;
 
+		/** Counters, updated by the connection handlers */
+		HttpServerStatistics statistics;
+
+		/** Limits of the client IP addresses, shared by all connection handlers */
+		HttpClientLimiter clientLimiter;
+
+		/** Decides the size of the pool, NULL for the default policy */
+		QSharedPointer<HttpPoolPolicy> poolPolicy;
+
+		/** A connection that waits for a free connection handler */
+		struct PendingConnection {
+			qintptr socketDescriptor;
+			int endpoint;
+			QHostAddress peerAddress;
+			qint64 enqueueTime;
+		};
+
+		/** Connections that wait for a free connection handler */
+		QQueue<PendingConnection> pendingConnections;
+
+		/** Time base of the accept queue */
+		QElapsedTimer clock;
+
+		/** Rejects connections that have been waiting for too long */
+		QTimer queueTimer;
+
+		/** Time when the waiting time first exceeded acceptQueueTarget, or 0 */
+		qint64 firstAboveTime;
+
+		/** Time of the next rejection while shedding */
+		qint64 dropNext;
+
+		/** Number of rejections in the current shedding state */
+		int dropCount;
+
+		/** Whether waiting connections are being shed because of overload */
+		bool dropping;
+
+		/** Pass a connection to a connection handler */
+		void dispatch(HttpConnectionHandler *handler, qintptr socketDescriptor);
+
+		/** Close a connection with status 503, or 429 if the client has too many connections */
+		void reject(qintptr socketDescriptor, int status = 503);
+
+		/** Close a waiting connection with status 503 and release it in the client limiter */
+		void rejectPending(const PendingConnection &pending);
+
+		/**
+		  Decide whether a waiting connection should be rejected because of overload, using the CoDel algorithm.
+		  @param waitTime How long the connection has been waiting
+		  @param now The current time
+		*/
+		bool shed(qint64 waitTime, qint64 now);
+
+		/** Reject all waiting connections */
+		void clearPendingConnections();
+
+		/** Whether drain() is in progress */
+		bool draining;
+
+		/** Limits the duration of drain() */
+		QTimer drainTimer;
+
+		/** Passes the listening socket to the next process, if handoffSocket is configured */
+		QLocalServer *handoffServer;
+
+		/** Accepts connections if unixSocket is configured */
+		HttpLocalServer *localServer;
+
+		/** Accept connections on the additional endpoints */
+		QList<HttpEndpointServer *> endpointServers;
+
+		/** Start listening on the additional endpoints */
+		void listenEndpoints();
+
+		/**
+		  Serves a new connection of any endpoint.
+		  @param socketDescriptor The accepted connection
+		  @param endpoint 0 for host and port, or 1 + the index in HttpServerConfig::endpoints
+		*/
+		void acceptConnection(qintptr socketDescriptor, int endpoint);
+
+		/** Get a listening socket from systemd or from the previous process, or -1 */
+		qintptr inheritSocket();
+
+		/** Offer the listening socket to the next process */
+		void startHandoffServer();
+
+		/** Finish drain() if all connections are closed */
+		void checkDrained();
+
+		/** Thread that accepts the connections if acceptThread is configured, otherwise NULL */
+		QThread *acceptThread;
+
+		/** Thread that created the listener */
+		QThread *ownerThread;
+
+		/** Measures the lag of the accepting event loop */
+		QTimer lagTimer;
+
+		/** Time of the previous lag measurement */
+		qint64 lagProbeTime;
+
+	  private slots:
+
+		/** Received from the lag timer, stores the lag of the event loop in the statistics */
+		void measureEventLoopLag();
+
+		/** Close the listener and move it back to the thread that created it, called before deletion */
+		void stopAcceptThread();
+
+		/** Close the connection pool after drain() */
+		void finishDrain();
+
+		/** Received from the handoff server when the next process asks for the listening socket */
+		void handOver();
+
+		/** Received from the pool when a connection handler is available */
+		void dispatchPending();
+
+		/** Received from the queue timer, rejects connections that have been waiting for too long */
+		void expirePending();
+
 	  signals:
 
+		/** Emitted when drain() has finished */
+		void drained();
+
 		/**
 		  Sent to the connection handler to process a new incoming connection.
 		  @param socketDescriptor references the accepted connection.
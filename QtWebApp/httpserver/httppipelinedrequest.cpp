@@ -0,0 +1,61 @@
+#include "httppipelinedrequest.h"
+
+using namespace qtwebapp;
+
+HttpPipelinedRequest::HttpPipelinedRequest(HttpPipelineBuffer *buffer, HttpRequest *request,
+                                           HttpRequestHandler *requestHandler, const HttpServerConfig &cfg,
+                                           const QAtomicInt *draining)
+    : buffer(buffer), request(request), response(this, cfg), requestHandler(requestHandler) {
+	setAutoDelete(false);
+	response.draining = draining;
+	finished = false;
+	head = false;
+}
+
+HttpPipelinedRequest::~HttpPipelinedRequest() {
+	delete request;
+}
+
+void HttpPipelinedRequest::run() {
+	try {
+		requestHandler->service(*request, response);
+	} catch (...) {
+		qCritical("HttpPipelinedRequest: An uncatched exception occured in the request handler");
+	}
+	if (!response.hasSentLastPart()) {
+		response.write(QByteArray(), true);
+	}
+	QMutexLocker locker(&buffer->mutex);
+	finished = true;
+	buffer->changed.wakeAll();
+}
+
+bool HttpPipelinedRequest::append(const QByteArray &data) {
+	QMutexLocker locker(&buffer->mutex);
+	// The response that is sent next must not wait, the connection handler takes its data meanwhile
+	while (buffer->connected.loadAcquire() && buffer->bufferedBytes > 0 &&
+	       buffer->bufferedBytes + data.size() > buffer->bufferLimit && !(head && output.isEmpty())) {
+		buffer->changed.wait(&buffer->mutex);
+	}
+	if (!buffer->connected.loadAcquire()) {
+		return false;
+	}
+	output.append(data);
+	buffer->bufferedBytes += data.size();
+	buffer->changed.wakeAll();
+	return true;
+}
+
+bool HttpPipelinedRequest::take(QByteArray &data, bool wait) {
+	QMutexLocker locker(&buffer->mutex);
+	head = true;
+	while (wait && output.isEmpty() && !finished) {
+		buffer->changed.wait(&buffer->mutex);
+	}
+	data.append(output);
+	buffer->bufferedBytes -= output.size();
+	output.clear();
+	// Responses that waited for space, including this one, may continue now
+	buffer->changed.wakeAll();
+	return finished;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "httprequest.h"
+#include "httprequesthandler.h"
+#include "httpresponse.h"
+#include "httpserverconfig.h"
+#include "qtwebappglobal.h"
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QMutex>
+#include <QRunnable>
+#include <QWaitCondition>
+
+namespace qtwebapp {
+
+	/** The state that the pipelined requests of a connection share with the connection handler */
+	struct HttpPipelineBuffer {
+		/** Used to synchronize the connection handler and the thread pool */
+		QMutex mutex;
+
+		/** Woken when a response has collected data or finished, and when the connection handler took data */
+		QWaitCondition changed;
+
+		/** The number of bytes that the responses have collected and the connection handler has not taken yet */
+		qint64 bufferedBytes;
+
+		/** The maximum of bufferedBytes, a single write of a response may exceed it if nothing is buffered */
+		qint64 bufferLimit;
+
+		/** Whether the connection is still open, cleared by the connection handler. Responses are discarded then. */
+		QAtomicInt connected;
+	};
+
+	/**
+	  A pipelined request that is serviced by the thread pool of the connection handler. Its response is
+	  collected in memory and sent by the connection handler in the order of the requests.
+	  <p>
+	  All responses of a connection together collect at most pipelineBufferSize bytes. A response that would
+	  exceed the limit waits until the connection handler has sent some of them. The response that is sent
+	  next never waits, the connection handler passes its data to the socket while it is generated.
+	  This class is used internally by HttpConnectionHandler.
+	*/
+	class QTWEBAPP_EXPORT HttpPipelinedRequest : public QRunnable {
+		Q_DISABLE_COPY(HttpPipelinedRequest)
+		friend class HttpConnectionHandler;
+		friend class HttpResponse;
+
+	  public:
+		/**
+		  Constructor.
+		  @param buffer The state shared by the pipelined requests of the connection
+		  @param request The request, this object takes ownership of it
+		  @param requestHandler Services the request
+		  @param cfg Configuration of the HTTP server
+		  @param draining Set by the connection handler when the server shuts down
+		*/
+		HttpPipelinedRequest(HttpPipelineBuffer *buffer, HttpRequest *request, HttpRequestHandler *requestHandler,
+		                     const HttpServerConfig &cfg, const QAtomicInt *draining);
+
+		/** Destructor, deletes the request */
+		virtual ~HttpPipelinedRequest();
+
+		/** Service the request, called by the thread pool */
+		virtual void run();
+
+	  private:
+		/** The state shared by the pipelined requests of the connection */
+		HttpPipelineBuffer *buffer;
+
+		/** The request */
+		HttpRequest *request;
+
+		/** The response, collected in the output */
+		HttpResponse response;
+
+		/** Services the request */
+		HttpRequestHandler *requestHandler;
+
+		/** Response data that the connection handler has not taken yet */
+		QByteArray output;
+
+		/** Whether the response is complete */
+		bool finished;
+
+		/** Whether this response is sent next */
+		bool head;
+
+		/**
+		  Collect response data, called by the HttpResponse in the thread pool. Waits while the buffer of the
+		  connection is full.
+		  @return False if the connection has been closed, so the data is discarded
+		*/
+		bool append(const QByteArray &data);
+
+		/**
+		  Take the collected response data, called by the connection handler. This makes the response the one
+		  that is sent next.
+		  @param data The collected data is appended to it
+		  @param wait Whether to wait until there is data or the response is complete
+		  @return Whether the response is complete, so all of its data has been taken
+		*/
+		bool take(QByteArray &data, bool wait);
+	};
+
+} // namespace qtwebapp
@@ -0,0 +1,34 @@
+#include "httppoolpolicy.h"
+
+#include <QtGlobal>
+
+#include <math.h>
+
+using namespace qtwebapp;
+
+AdaptivePoolPolicy::AdaptivePoolPolicy(double smoothing, double headroom, double maxTrend, double maxGrowth)
+    : smoothing(smoothing), headroom(headroom), maxTrend(maxTrend), maxGrowth(maxGrowth) {
+	busyAverage = 0;
+	acceptAverage = 0;
+	first = true;
+}
+
+int AdaptivePoolPolicy::targetSize(const HttpPoolStatus &status) {
+	// Handlers that had to be created on demand were missing, so they count as busy
+	double busy = status.busy + status.created;
+	if (first) {
+		busyAverage = busy;
+		acceptAverage = status.accepted;
+		first = false;
+	}
+
+	// Connections that arrive faster than on average will need proportionally more handlers soon
+	double trend = acceptAverage > 0 ? qBound(1.0, status.accepted / acceptAverage, maxTrend) : 1.0;
+	busyAverage = smoothing * busy + (1 - smoothing) * busyAverage;
+	acceptAverage = smoothing * status.accepted + (1 - smoothing) * acceptAverage;
+
+	double expected = qMax(busy, busyAverage) * trend;
+	int target = int(ceil(expected * (1 + headroom)));
+	int growthLimit = status.size + qMax(1, int(ceil(status.size * maxGrowth)));
+	return qMin(target, growthLimit);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "qtwebappglobal.h"
+
+namespace qtwebapp {
+
+	/** Status of a HttpConnectionHandlerPool, passed to its HttpPoolPolicy */
+	struct HttpPoolStatus {
+		/** Number of connection handlers, without the ones that are shutting down */
+		int size;
+
+		/** Number of busy connection handlers */
+		int busy;
+
+		/** Number of connections accepted since the previous decision */
+		int accepted;
+
+		/** Number of handlers that had to be created for new connections since the previous decision */
+		int created;
+
+		/** The configured minimum number of handlers */
+		int minThreads;
+
+		/** The configured maximum number of handlers */
+		int maxThreads;
+	};
+
+	/**
+	  Decides how many connection handlers a HttpConnectionHandlerPool keeps. The pool asks its policy
+	  once in each cleanupInterval. If the pool is smaller than the decision, handlers are created
+	  immediately, so that their threads are ready before connections arrive. If it is larger, one idle
+	  handler is shut down in each interval.
+	  <p>
+	  Implement this interface to change the sizing of the pool, see HttpListener::setPoolPolicy().
+	  The methods are called by a single thread.
+	*/
+	class QTWEBAPP_EXPORT HttpPoolPolicy {
+	  public:
+		/** Destructor */
+		virtual ~HttpPoolPolicy() {}
+
+		/**
+		  Decide the number of connection handlers.
+		  @param status The status of the pool since the previous call
+		  @return The desired number of handlers, it is limited to minThreads and maxThreads by the pool
+		*/
+		virtual int targetSize(const HttpPoolStatus &status) = 0;
+	};
+
+	/**
+	  The default policy. It keeps a moving average (EWMA) of busy handlers and of accepted connections.
+	  When connections arrive faster than on average, the expected number of busy handlers grows by the
+	  same ratio, so the pool grows ahead of the demand. A headroom of spare handlers is added on top.
+	  <p>
+	  The ratio is limited, because the average decays towards 0 while the server is idle, and a
+	  small burst after an idle period would otherwise start maxThreads handlers at once. For the same
+	  reason, the pool grows by at most a fraction of its current size in each decision.
+	*/
+	class QTWEBAPP_EXPORT AdaptivePoolPolicy : public HttpPoolPolicy {
+	  public:
+		/**
+		  Constructor.
+		  @param smoothing Weight of the newest sample in the moving averages, between 0 and 1
+		  @param headroom Fraction of spare handlers in addition to the expected busy handlers
+		  @param maxTrend Maximum ratio of the accepted connections to their average
+		  @param maxGrowth Maximum fraction of the current size that is added in one decision, at least
+		  one handler is added
+		*/
+		AdaptivePoolPolicy(double smoothing = 0.3, double headroom = 0.25, double maxTrend = 3.0,
+		                   double maxGrowth = 1.0);
+
+		virtual int targetSize(const HttpPoolStatus &status);
+
+	  private:
+		/** Weight of the newest sample */
+		double smoothing;
+
+		/** Fraction of spare handlers */
+		double headroom;
+
+		/** Maximum ratio of the accepted connections to their average */
+		double maxTrend;
+
+		/** Maximum growth in one decision */
+		double maxGrowth;
+
+		/** Moving average of busy handlers */
+		double busyAverage;
+
+		/** Moving average of accepted connections per interval */
+		double acceptAverage;
+
+		/** Whether no sample has been taken yet */
+		bool first;
+	};
+
+} // namespace qtwebapp
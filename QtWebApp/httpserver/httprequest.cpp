@@ -7,174 +7,460 @@
 
 #include "httpcookie.h"
 
+#include <QBuffer>
 #include <QDir>
 #include <QList>
 
 using namespace qtwebapp;
 
+/** Number of bytes that are read at once while collecting a request or header line */
+static const int lineChunkSize = 4096;
+
+/** Whitespace as removed by QByteArray::trimmed() */
+static inline bool isWhitespace(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+/** Shrink the range [start,end) of data so that it excludes leading and trailing whitespace */
+static void trimRange(const char *data, int &start, int &end) {
+	while (start < end && isWhitespace(data[start])) {
+		++start;
+	}
+	while (end > start && isWhitespace(data[end - 1])) {
+		--end;
+	}
+}
+
+/** Connections on a Unix domain socket have no peer address, but they come from the local host */
+static QHostAddress clientAddress(const QHostAddress &peer) {
+	return peer.isNull() ? QHostAddress(QHostAddress::LocalHost) : peer;
+}
+
 HttpRequest::HttpRequest(const HttpServerConfig &cfg) {
 	status = waitForRequest;
 	currentSize = 0;
 	expectedBodySize = 0;
 	maxSize = cfg.maxRequestSize;
 	maxMultiPartSize = cfg.maxMultipartSize;
-	tempFile = nullptr;
+	maxMultipartMemorySize = cfg.maxMultipartMemorySize;
+	maxHeaderCount = cfg.maxHeaderCount;
+	maxHeaderLineSize = cfg.maxHeaderLineSize;
+	headerTooLarge = false;
+	uriTooLong = false;
+	unsupportedEncoding = false;
+	chunkedBody = false;
+	streamedBody = false;
+	readTimeout = cfg.readTimeout;
+	body = nullptr;
+	multipartBody = nullptr;
 	tmpDir = cfg.tmpDir;
+	// These buffers keep their capacity when the request is reset for the next request on the same connection
+	lineBuffer.reserve(lineChunkSize + 1);
+	headerBuffer.reserve(lineChunkSize);
+	headers.reserve(32);
 }
 
-void HttpRequest::readRequest(QTcpSocket *socket) {
+void HttpRequest::reset() {
+	delete body;
+	body = nullptr;
+	foreach (QIODevice *file, uploadedFiles) {
+		if (file->isOpen()) {
+			file->close();
+		}
+		delete file;
+	}
+	uploadedFiles.clear();
+	if (multipartBody != nullptr) {
+		if (multipartBody->isOpen()) {
+			multipartBody->close();
+		}
+		delete multipartBody;
+		multipartBody = nullptr;
+	}
+	headerBuffer.resize(0);
+	headers.resize(0);
+	parameters.clear();
+	cookies.clear();
+	bodyData.clear();
+	method.clear();
+	path.clear();
+	version.clear();
+	boundary.clear();
+	lineBuffer.resize(0);
+	peerAddress.clear();
+	status = waitForRequest;
+	currentSize = 0;
+	expectedBodySize = 0;
+	headerTooLarge = false;
+	uriTooLong = false;
+	unsupportedEncoding = false;
+	chunkedBody = false;
+	streamedBody = false;
+}
+
+bool HttpRequest::readLine(QTcpSocket *socket) {
+	int toRead = qMin(maxSize - currentSize + 1, lineChunkSize); // allow one byte more to be able to detect overflow
+	int oldSize = lineBuffer.size();
+	// Read directly into the line buffer, QIODevice::readLine() needs space for a terminating zero
+	lineBuffer.resize(oldSize + toRead + 1);
+	qint64 read = socket->readLine(lineBuffer.data() + oldSize, toRead + 1);
+	if (read < 0) {
+		read = 0;
+	}
+	lineBuffer.resize(oldSize + int(read));
+	currentSize += int(read);
+	// Do not collect a line that never ends, even if it fits into maxRequestSize
+	if (lineBuffer.size() > maxHeaderLineSize) {
+		qWarning("HttpRequest: received a too long request line or header line");
+		// The request line consists mainly of the URI
+		if (status == waitForRequest) {
+			uriTooLong = true;
+		} else {
+			headerTooLarge = true;
+		}
+		status = abort;
+		return false;
+	}
+	if (!lineBuffer.endsWith('\n')) {
 #ifdef SUPERVERBOSE
-	qDebug("HttpRequest: read request");
+		qDebug("HttpRequest: collecting more parts until line break");
 #endif
-	int toRead = maxSize - currentSize + 1; // allow one byte more to be able to detect overflow
-	lineBuffer.append(socket->readLine(toRead));
-	currentSize += lineBuffer.size();
-	if (!lineBuffer.contains("\r\n")) {
+		return false;
+	}
+	return true;
+}
+
+void HttpRequest::readRequest(QTcpSocket *socket) {
 #ifdef SUPERVERBOSE
-		qDebug("HttpRequest: collecting more parts until line break");
+	qDebug("HttpRequest: read request");
 #endif
+	if (!readLine(socket)) {
 		return;
 	}
-	QByteArray newData = lineBuffer.trimmed();
-	lineBuffer.clear();
-	if (!newData.isEmpty()) {
+	int start = 0;
+	int end = lineBuffer.size();
+	trimRange(lineBuffer.constData(), start, end);
+	if (start < end) {
 #ifdef CMAKE_DEBUG
-		qDebug("HttpRequest: from %s: %s", qPrintable(socket->peerAddress().toString()), newData.data());
+		qDebug("HttpRequest: from %s: %s", qPrintable(socket->peerAddress().toString()),
+		       lineBuffer.mid(start, end - start).data());
 #endif
-		QList<QByteArray> list = newData.split(' ');
-		if (list.count() != 3 || !list.at(2).contains("HTTP")) {
+		// The line must consist of exactly three parts, separated by single spaces
+		int space1 = lineBuffer.indexOf(' ', start);
+		int space2 = space1 < 0 ? -1 : lineBuffer.indexOf(' ', space1 + 1);
+		int space3 = space2 < 0 ? -1 : lineBuffer.indexOf(' ', space2 + 1);
+		if (space1 < 0 || space2 < 0 || space2 >= end || (space3 >= 0 && space3 < end) ||
+		    lineBuffer.indexOf("HTTP", space2 + 1) < 0) {
 			qWarning("HttpRequest: received broken HTTP request, invalid first line");
 			status = abort;
 		} else {
-			method = list.at(0).trimmed();
-			path = list.at(1);
-			version = list.at(2);
-			peerAddress = socket->peerAddress();
+			method = lineBuffer.mid(start, space1 - start);
+			path = lineBuffer.mid(space1 + 1, space2 - space1 - 1);
+			version = lineBuffer.mid(space2 + 1, end - space2 - 1);
+			peerAddress = clientAddress(socket->peerAddress());
 			status = waitForHeader;
 		}
 	}
+	lineBuffer.resize(0);
 }
 
 void HttpRequest::readHeader(QTcpSocket *socket) {
 #ifdef SUPERVERBOSE
 	qDebug("HttpRequest: read header");
 #endif
-	int toRead = maxSize - currentSize + 1; // allow one byte more to be able to detect overflow
-	lineBuffer.append(socket->readLine(toRead));
-	currentSize += lineBuffer.size();
-	if (!lineBuffer.contains("\r\n")) {
-#ifdef SUPERVERBOSE
-		qDebug("HttpRequest: collecting more parts until line break");
-#endif
+	if (!readLine(socket)) {
 		return;
 	}
-	QByteArray newData = lineBuffer.trimmed();
-	lineBuffer.clear();
-	int colon = newData.indexOf(':');
-	if (colon > 0) {
+	const char *line = lineBuffer.constData();
+	int start = 0;
+	int end = lineBuffer.size();
+	trimRange(line, start, end);
+	bool emptyLine = start >= end;
+	int colon = lineBuffer.indexOf(':', start);
+	if (colon > start && colon < end) {
 		// Received a line with a colon - a header
-		currentHeader = newData.left(colon).toLower();
-		QByteArray value = newData.mid(colon + 1).trimmed();
-		headers.insert(currentHeader, value);
+		if (headers.size() >= maxHeaderCount) {
+			qWarning("HttpRequest: received too many headers");
+			headerTooLarge = true;
+			status = abort;
+			return;
+		}
+		int valueStart = colon + 1;
+		int valueEnd = end;
+		trimRange(line, valueStart, valueEnd);
+		HeaderEntry entry;
+		entry.name = headerBuffer.size();
+		entry.nameSize = colon - start;
+		headerBuffer.append(line + start, entry.nameSize);
+		char *name = headerBuffer.data() + entry.name;
+		for (int i = 0; i < entry.nameSize; ++i) {
+			if (name[i] >= 'A' && name[i] <= 'Z') {
+				name[i] += 'a' - 'A';
+			}
+		}
+		entry.value = headerBuffer.size();
+		entry.valueSize = valueEnd - valueStart;
+		headerBuffer.append(line + valueStart, entry.valueSize);
+		headers.append(entry);
 #ifdef SUPERVERBOSE
-		qDebug("HttpRequest: received header %s: %s", currentHeader.data(), value.data());
+		qDebug("HttpRequest: received header %s: %s", lineBuffer.mid(start, entry.nameSize).data(),
+		       lineBuffer.mid(valueStart, entry.valueSize).data());
 #endif
-	} else if (!newData.isEmpty()) {
+	} else if (!emptyLine) {
 		// received another line - belongs to the previous header
 #ifdef SUPERVERBOSE
 		qDebug("HttpRequest: read additional line of header");
 #endif
-		// Received additional line of previous header
-		if (headers.contains(currentHeader)) {
-			headers.insert(currentHeader, headers.value(currentHeader) + " " + newData);
+		// Received additional line of previous header. That header is always the last one in the buffer.
+		if (!headers.isEmpty()) {
+			headerBuffer.append(' ');
+			headerBuffer.append(line + start, end - start);
+			headers.last().valueSize += 1 + end - start;
 		}
-	} else {
-		// received an empty line - end of headers reached
+	}
+	lineBuffer.resize(0);
+	if (!emptyLine) {
+		return;
+	}
+
+	// received an empty line - end of headers reached
 #ifdef SUPERVERBOSE
-		qDebug("HttpRequest: headers completed");
+	qDebug("HttpRequest: headers completed");
 #endif
-		// Empty line received, that means all headers have been received
-		// Check for multipart/form-data
-		QByteArray contentType = headers.value("content-type");
-		if (contentType.startsWith("multipart/form-data")) {
-			int posi = contentType.indexOf("boundary=");
-			if (posi >= 0) {
-				boundary = contentType.mid(posi + 9);
-				if (boundary.startsWith('"') && boundary.endsWith('"')) {
-					boundary = boundary.mid(1, boundary.length() - 2);
-				}
+	// Empty line received, that means all headers have been received
+	extractBoundary();
+	// Check for chunked body, in which case the Content-Length header must be ignored
+	QByteArray transferEncoding = getHeader("transfer-encoding").trimmed().toLower();
+	if (!transferEncoding.isEmpty()) {
+		// Other codings like "gzip, chunked" would pass a body to the request handler that is still encoded
+		if (transferEncoding == "chunked") {
+			chunkedBody = true;
+		} else {
+			qWarning("HttpRequest: unsupported transfer encoding %s", transferEncoding.data());
+			unsupportedEncoding = true;
+			status = abort;
+			return;
+		}
+	}
+	QByteArray contentLength = rawHeader("content-length");
+	if (!chunkedBody && !contentLength.isEmpty()) {
+		expectedBodySize = contentLength.toInt();
+	}
+	if (!chunkedBody && expectedBodySize == 0) {
+#ifdef SUPERVERBOSE
+		qDebug("HttpRequest: expect no body");
+#endif
+		status = complete;
+	} else if (expectedBodySize < 0) {
+		qWarning("HttpRequest: received invalid content length");
+		status = abort;
+	} else {
+		// The body is prepared by startBody()
+		status = waitForBody;
+	}
+}
+
+void HttpRequest::extractBoundary() {
+	// Check for multipart/form-data
+	QByteArray contentType = rawHeader("content-type");
+	if (contentType.startsWith("multipart/form-data")) {
+		int posi = contentType.indexOf("boundary=");
+		if (posi >= 0) {
+			boundary = contentType.mid(posi + 9);
+			if (boundary.startsWith('"') && boundary.endsWith('"')) {
+				boundary = boundary.mid(1, boundary.length() - 2);
 			}
 		}
-		QByteArray contentLength = headers.value("content-length");
-		if (!contentLength.isEmpty()) {
-			expectedBodySize = contentLength.toInt();
+	}
+}
+
+void HttpRequest::addHeader(const QByteArray &name, const QByteArray &value) {
+	HeaderEntry entry;
+	entry.name = headerBuffer.size();
+	entry.nameSize = name.size();
+	headerBuffer.append(name);
+	entry.value = headerBuffer.size();
+	entry.valueSize = value.size();
+	headerBuffer.append(value);
+	headers.append(entry);
+}
+
+bool HttpRequest::readStreamHeaders(const QList<Http2Header> &fields, bool endStream, const QHostAddress &peer) {
+	Q_ASSERT(status == waitForRequest);
+	QByteArray scheme;
+	QByteArray authority;
+	bool regularField = false;
+	foreach (const Http2Header &field, fields) {
+		const QByteArray &name = field.first;
+		const QByteArray &value = field.second;
+		if (name.startsWith(':')) {
+			// Pseudo-header fields must precede the regular fields and must not repeat
+			QByteArray *target = nullptr;
+			if (name == ":method") {
+				target = &method;
+			} else if (name == ":path") {
+				target = &path;
+			} else if (name == ":scheme") {
+				target = &scheme;
+			} else if (name == ":authority") {
+				target = &authority;
+			}
+			if (regularField || target == nullptr || !target->isEmpty() || value.isEmpty()) {
+				return false;
+			}
+			*target = value;
+			continue;
 		}
-		if (expectedBodySize == 0) {
+		regularField = true;
+		// Names must be lower-case, and connection-specific fields are not allowed
+		for (int i = 0; i < name.size(); ++i) {
+			if (name.at(i) >= 'A' && name.at(i) <= 'Z') {
+				return false;
+			}
+		}
+		if (name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+		    name == "transfer-encoding" || name == "upgrade" || (name == "te" && value != "trailers")) {
+			return false;
+		}
+		if (headers.size() >= maxHeaderCount) {
+			qWarning("HttpRequest: received too many headers");
+			headerTooLarge = true;
+			status = abort;
+			return true;
+		}
+		addHeader(name, value);
 #ifdef SUPERVERBOSE
-			qDebug("HttpRequest: expect no body");
+		qDebug("HttpRequest: received header %s: %s", name.data(), value.data());
 #endif
-			status = complete;
-		} else if (boundary.isEmpty() && expectedBodySize + currentSize > maxSize) {
+	}
+	if (method.isEmpty() || path.isEmpty() || scheme.isEmpty()) {
+		return false;
+	}
+	// The authority replaces the Host header of HTTP/1.1
+	if (!authority.isEmpty() && findHeader("host", 4, headers.size()) < 0) {
+		addHeader("host", authority);
+	}
+	version = "HTTP/2.0";
+	peerAddress = clientAddress(peer);
+	currentSize = path.size() + headerBuffer.size();
+#ifdef CMAKE_DEBUG
+	qDebug("HttpRequest: from %s: %s %s (HTTP/2)", qPrintable(peer.toString()), method.data(), path.data());
+#endif
+
+	extractBoundary();
+	QByteArray contentLength = rawHeader("content-length");
+	if (!contentLength.isEmpty()) {
+		expectedBodySize = contentLength.toInt();
+		if (expectedBodySize < 0) {
+			return false;
+		}
+		if ((boundary.isEmpty() && expectedBodySize + currentSize > maxSize) ||
+		    (!boundary.isEmpty() && expectedBodySize > maxMultiPartSize)) {
 			qWarning("HttpRequest: expected body is too large");
 			status = abort;
+			return true;
+		}
+	}
+	if (!endStream) {
+		status = waitForBody;
+		return true;
+	}
+	status = complete;
+	decodeRequestParams();
+	extractCookies();
+	return true;
+}
+
+void HttpRequest::readFromStream(const QByteArray &data, bool endStream) {
+	Q_ASSERT(status == waitForBody);
+	appendBody(data, endStream);
+	if (boundary.isEmpty() && currentSize > maxSize) {
+		qWarning("HttpRequest: received too many bytes");
+		status = abort;
+	}
+	if (status == complete) {
+		// Extract and decode request parameters from url and body
+		decodeRequestParams();
+		// Extract cookies from headers
+		extractCookies();
+	}
+}
+
+void HttpRequest::startBody(QTcpSocket *socket, bool streamed) {
+	Q_ASSERT(status == waitForBody && body == nullptr);
+	streamedBody = streamed;
+	if (!streamed) {
+		if (boundary.isEmpty() && expectedBodySize + currentSize > maxSize) {
+			qWarning("HttpRequest: expected body is too large");
+			status = abort;
+			return;
 		} else if (!boundary.isEmpty() && expectedBodySize > maxMultiPartSize) {
 			qWarning("HttpRequest: expected multipart body is too large");
 			status = abort;
-		} else {
+			return;
+		}
+	}
 #ifdef SUPERVERBOSE
-			qDebug("HttpRequest: expect %i bytes body", expectedBodySize);
+	if (chunkedBody) {
+		qDebug("HttpRequest: expect chunked body");
+	} else {
+		qDebug("HttpRequest: expect %i bytes body", expectedBodySize);
+	}
 #endif
-			status = waitForBody;
-		}
+	body = new HttpRequestBody(socket, chunkedBody ? -1 : expectedBodySize);
+	if (streamed) {
+		// The request handler reads the body itself, so everything else must be available now
+		body->setReadTimeout(readTimeout);
+		decodeRequestParams();
+		extractCookies();
 	}
 }
 
 void HttpRequest::readBody(QTcpSocket *socket) {
-	Q_ASSERT(expectedBodySize != 0);
+	Q_UNUSED(socket)
+	Q_ASSERT(body != nullptr);
+	// Multipart bodies are transferred in 64kb blocks
+	int toRead = boundary.isEmpty() ? maxSize - currentSize + 1 : 65536; // allow one byte more to detect overflow
+	appendBody(body->read(toRead), body->isComplete());
+	if (body->hasFailed()) {
+		status = abort;
+	}
+}
+
+void HttpRequest::appendBody(const QByteArray &newData, bool last) {
 	if (boundary.isEmpty()) {
 		// normal body, no multipart
 #ifdef SUPERVERBOSE
 		qDebug("HttpRequest: receive body");
 #endif
-		int toRead = expectedBodySize - bodyData.size();
-		QByteArray newData = socket->read(toRead);
 		currentSize += newData.size();
 		bodyData.append(newData);
-		if (bodyData.size() >= expectedBodySize) {
+		if (last) {
 			status = complete;
 		}
 	} else {
-		// multipart body, store into temp file
+		// multipart body, store into memory or temp file
 #ifdef SUPERVERBOSE
 		qDebug("HttpRequest: receiving multipart body");
 #endif
-		// Create an object for the temporary file, if not already present
-		if (tempFile == nullptr) {
-			tempFile = new QTemporaryFile(tmpDir);
-		}
-		if (!tempFile->isOpen()) {
-			tempFile->open();
-		}
-		// Transfer data in 64kb blocks
-		qint64 fileSize = tempFile->size();
-		qint64 toRead = expectedBodySize - fileSize;
-		if (toRead > 65536) {
-			toRead = 65536;
+		// Create the buffer, if not already present
+		if (multipartBody == nullptr) {
+			multipartBody = new QBuffer();
+			multipartBody->open(QIODevice::ReadWrite);
 		}
-		fileSize += tempFile->write(socket->read(toRead));
+		qint64 fileSize = multipartBody->size() + newData.size();
 		if (fileSize >= maxMultiPartSize) {
 			qWarning("HttpRequest: received too many multipart bytes");
 			status = abort;
-		} else if (fileSize >= expectedBodySize) {
+		} else if (!writeMultipartData(multipartBody, newData)) {
+			qCritical("HttpRequest: Error writing temp file for multipart body");
+			status = abort;
+		} else if (last) {
 #ifdef SUPERVERBOSE
 			qDebug("HttpRequest: received whole multipart body");
 #endif
-			tempFile->flush();
-			if (tempFile->error()) {
-				qCritical("HttpRequest: Error writing temp file for multipart body");
-			}
 			parseMultiPartFile();
-			tempFile->close();
+			multipartBody->close();
 			status = complete;
 		}
 	}
@@ -192,7 +478,7 @@ void HttpRequest::decodeRequestParams() {
 		path = path.left(questionMark);
 	}
 	// Get request body parameters
-	QByteArray contentType = headers.value("content-type");
+	QByteArray contentType = rawHeader("content-type");
 	if (!bodyData.isEmpty() && (contentType.isEmpty() || contentType.startsWith("application/x-www-form-urlencoded"))) {
 		if (!rawParameters.isEmpty()) {
 			rawParameters.append('&');
@@ -201,6 +487,9 @@ void HttpRequest::decodeRequestParams() {
 			rawParameters = bodyData;
 		}
 	}
+	if (rawParameters.isEmpty()) {
+		return;
+	}
 	// Split the parameters into pairs of value and name
 	QList<QByteArray> list = rawParameters.split('&');
 	foreach (QByteArray part, list) {
@@ -220,7 +509,10 @@ void HttpRequest::extractCookies() {
 #ifdef SUPERVERBOSE
 	qDebug("HttpRequest: extract cookies");
 #endif
-	foreach (QByteArray cookieStr, headers.values("cookie")) {
+	if (findHeader("cookie", 6, headers.size()) < 0) {
+		return;
+	}
+	foreach (QByteArray cookieStr, getHeaders("cookie")) {
 		QList<QByteArray> list = HttpCookie::splitCSV(cookieStr);
 		foreach (QByteArray part, list) {
 #ifdef SUPERVERBOSE
@@ -239,7 +531,12 @@ void HttpRequest::extractCookies() {
 			cookies.insert(name, value);
 		}
 	}
-	headers.remove("cookie");
+	for (int i = headers.size() - 1; i >= 0; --i) {
+		const HeaderEntry &entry = headers.at(i);
+		if (entry.nameSize == 6 && qstrncmp(headerBuffer.constData() + entry.name, "cookie", 6) == 0) {
+			headers.remove(i);
+		}
+	}
 }
 
 void HttpRequest::readFromSocket(QTcpSocket *socket) {
@@ -249,7 +546,12 @@ void HttpRequest::readFromSocket(QTcpSocket *socket) {
 	} else if (status == waitForHeader) {
 		readHeader(socket);
 	} else if (status == waitForBody) {
-		readBody(socket);
+		if (body == nullptr) {
+			startBody(socket, false);
+		}
+		if (status == waitForBody) {
+			readBody(socket);
+		}
 	}
 	if ((boundary.isEmpty() && currentSize > maxSize) || (!boundary.isEmpty() && currentSize > maxMultiPartSize)) {
 		qWarning("HttpRequest: received too many bytes");
@@ -283,16 +585,57 @@ QByteArray HttpRequest::getVersion() const {
 	return version;
 }
 
+int HttpRequest::findHeader(const char *name, int size, int before) const {
+	for (int i = before - 1; i >= 0; --i) {
+		const HeaderEntry &entry = headers.at(i);
+		if (entry.nameSize == size && qstrnicmp(headerBuffer.constData() + entry.name, name, uint(size)) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+QByteArray HttpRequest::rawHeader(const char *name) const {
+	int index = findHeader(name, int(qstrlen(name)), headers.size());
+	if (index < 0) {
+		return QByteArray();
+	}
+	const HeaderEntry &entry = headers.at(index);
+	return QByteArray::fromRawData(headerBuffer.constData() + entry.value, entry.valueSize);
+}
+
+bool HttpRequest::headerEquals(const char *name, const char *value) const {
+	QByteArray raw = rawHeader(name);
+	return raw.size() == int(qstrlen(value)) && qstrnicmp(raw.constData(), value, uint(raw.size())) == 0;
+}
+
 QByteArray HttpRequest::getHeader(const QByteArray &name) const {
-	return headers.value(name.toLower());
+	int index = findHeader(name.constData(), name.size(), headers.size());
+	if (index < 0) {
+		return QByteArray();
+	}
+	const HeaderEntry &entry = headers.at(index);
+	return QByteArray(headerBuffer.constData() + entry.value, entry.valueSize);
 }
 
 QList<QByteArray> HttpRequest::getHeaders(const QByteArray &name) const {
-	return headers.values(name.toLower());
+	QList<QByteArray> values;
+	int index = findHeader(name.constData(), name.size(), headers.size());
+	while (index >= 0) {
+		const HeaderEntry &entry = headers.at(index);
+		values.append(QByteArray(headerBuffer.constData() + entry.value, entry.valueSize));
+		index = findHeader(name.constData(), name.size(), index);
+	}
+	return values;
 }
 
 QMultiMap<QByteArray, QByteArray> HttpRequest::getHeaderMap() const {
-	return headers;
+	QMultiMap<QByteArray, QByteArray> map;
+	foreach (const HeaderEntry &entry, headers) {
+		map.insert(QByteArray(headerBuffer.constData() + entry.name, entry.nameSize),
+		           QByteArray(headerBuffer.constData() + entry.value, entry.valueSize));
+	}
+	return map;
 }
 
 QByteArray HttpRequest::getParameter(const QByteArray &name) const {
@@ -311,6 +654,10 @@ QByteArray HttpRequest::getBody() const {
 	return bodyData;
 }
 
+HttpRequestBody *HttpRequest::getBodyDevice() const {
+	return streamedBody ? body : nullptr;
+}
+
 QByteArray HttpRequest::urlDecode(const QByteArray source) {
 	QByteArray buffer(source);
 	buffer.replace('+', ' ');
@@ -327,20 +674,45 @@ QByteArray HttpRequest::urlDecode(const QByteArray source) {
 	return buffer;
 }
 
+/** Returns whether a buffer or file has an I/O error */
+static bool hasError(const QIODevice *device) {
+	const QFileDevice *file = qobject_cast<const QFileDevice *>(device);
+	return file && file->error() != QFileDevice::NoError;
+}
+
+bool HttpRequest::writeMultipartData(QIODevice *&device, const QByteArray &data) {
+	QBuffer *buffer = qobject_cast<QBuffer *>(device);
+	if (buffer && buffer->size() + data.size() > maxMultipartMemorySize) {
+#ifdef SUPERVERBOSE
+		qDebug("HttpRequest: moving multipart data into temp file");
+#endif
+		QTemporaryFile *file = new QTemporaryFile(tmpDir);
+		if (!file->open()) {
+			qCritical("HttpRequest: cannot create temp file, %s", qPrintable(file->errorString()));
+			delete file;
+			return false;
+		}
+		file->write(buffer->data());
+		delete buffer;
+		device = file;
+	}
+	return device->write(data) == data.size() && !hasError(device);
+}
+
 void HttpRequest::parseMultiPartFile() {
 #ifdef CMAKE_DEBUG
-	qDebug("HttpRequest: parsing multipart temp file");
+	qDebug("HttpRequest: parsing multipart body");
 #endif
-	tempFile->seek(0);
+	multipartBody->seek(0);
 	bool finished = false;
-	while (!tempFile->atEnd() && !finished && !tempFile->error()) {
+	while (!multipartBody->atEnd() && !finished && !hasError(multipartBody)) {
 #ifdef SUPERVERBOSE
 		qDebug("HttpRequest: reading multpart headers");
 #endif
 		QByteArray fieldName;
 		QByteArray fileName;
-		while (!tempFile->atEnd() && !finished && !tempFile->error()) {
-			QByteArray line = tempFile->readLine(65536).trimmed();
+		while (!multipartBody->atEnd() && !finished && !hasError(multipartBody)) {
+			QByteArray line = multipartBody->readLine(65536).trimmed();
 			if (line.startsWith("Content-Disposition:")) {
 				if (line.contains("form-data")) {
 					int start = line.indexOf(" name=\"");
@@ -367,10 +739,10 @@ void HttpRequest::parseMultiPartFile() {
 #ifdef SUPERVERBOSE
 		qDebug("HttpRequest: reading multpart data");
 #endif
-		QTemporaryFile *uploadedFile = nullptr;
+		QIODevice *uploadedFile = nullptr;
 		QByteArray fieldValue;
-		while (!tempFile->atEnd() && !finished && !tempFile->error()) {
-			QByteArray line = tempFile->readLine(65536);
+		while (!multipartBody->atEnd() && !finished && !hasError(multipartBody)) {
+			QByteArray line = multipartBody->readLine(65536);
 			if (line.startsWith("--" + boundary)) {
 				// Boundary found. Until now we have collected 2 bytes too much,
 				// so remove them from the last result
@@ -387,8 +759,14 @@ void HttpRequest::parseMultiPartFile() {
 #ifdef SUPERVERBOSE
 						qDebug("HttpRequest: finishing writing to uploaded file");
 #endif
-						uploadedFile->resize(uploadedFile->size() - 2);
-						uploadedFile->flush();
+						QBuffer *buffer = qobject_cast<QBuffer *>(uploadedFile);
+						if (buffer) {
+							buffer->buffer().chop(2);
+						} else {
+							QTemporaryFile *file = static_cast<QTemporaryFile *>(uploadedFile);
+							file->resize(file->size() - 2);
+							file->flush();
+						}
 						uploadedFile->seek(0);
 						parameters.insert(fieldName, fileName);
 #ifdef CMAKE_DEBUG
@@ -415,42 +793,49 @@ void HttpRequest::parseMultiPartFile() {
 				} else if (!fileName.isEmpty() && !fieldName.isEmpty()) {
 					// this is a file
 					if (!uploadedFile) {
-						uploadedFile = new QTemporaryFile(tmpDir);
-						uploadedFile->open();
+						uploadedFile = new QBuffer();
+						uploadedFile->open(QIODevice::ReadWrite);
 					}
-					uploadedFile->write(line);
-					if (uploadedFile->error()) {
+					if (!writeMultipartData(uploadedFile, line)) {
 						qCritical("HttpRequest: error writing temp file, %s", qPrintable(uploadedFile->errorString()));
 					}
 				}
 			}
 		}
 	}
-	if (tempFile->error()) {
-		qCritical("HttpRequest: cannot read temp file, %s", qPrintable(tempFile->errorString()));
+	if (hasError(multipartBody)) {
+		qCritical("HttpRequest: cannot read temp file, %s", qPrintable(multipartBody->errorString()));
 	}
 #ifdef SUPERVERBOSE
-	qDebug("HttpRequest: finished parsing multipart temp file");
+	qDebug("HttpRequest: finished parsing multipart body");
 #endif
 }
 
 HttpRequest::~HttpRequest() {
-	foreach (QByteArray key, uploadedFiles.keys()) {
-		QFile *file = uploadedFiles.value(key);
-		if (file->isOpen()) {
-			file->close();
-		}
-		delete file;
+	reset();
+}
+
+QFile *HttpRequest::getUploadedFile(const QByteArray fieldName) const {
+	QIODevice *device = uploadedFiles.value(fieldName);
+	QBuffer *buffer = qobject_cast<QBuffer *>(device);
+	if (!buffer) {
+		return static_cast<QFile *>(device);
 	}
-	if (tempFile != nullptr) {
-		if (tempFile->isOpen()) {
-			tempFile->close();
-		}
-		delete tempFile;
+	// The caller expects a file, so the data that has been kept in memory is written to a temp file
+	QTemporaryFile *file = new QTemporaryFile(tmpDir);
+	if (!file->open() || file->write(buffer->data()) != buffer->size()) {
+		qCritical("HttpRequest: cannot create temp file, %s", qPrintable(file->errorString()));
+		delete file;
+		return nullptr;
 	}
+	file->flush();
+	file->seek(buffer->pos());
+	delete buffer;
+	uploadedFiles.insert(fieldName, file);
+	return file;
 }
 
-QFile *HttpRequest::getUploadedFile(const QByteArray fieldName) const {
+QIODevice *HttpRequest::getUploadedData(const QByteArray fieldName) const {
 	return uploadedFiles.value(fieldName);
 }
 
@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include "http2hpack.h"
+#include "httprequestbody.h"
 #include "httpserverconfig.h"
 #include "qtwebappglobal.h"
 
@@ -15,6 +17,7 @@
 #include <QTcpSocket>
 #include <QTemporaryFile>
 #include <QUuid>
+#include <QVector>
 
 namespace qtwebapp {
 
@@ -27,17 +30,36 @@ namespace qtwebapp {
 	  <code><pre>
 	  maxRequestSize=16000
 	  maxMultiPartSize=1000000
+	  maxHeaderCount=100
+	  maxHeaderLineSize=8192
 	  </pre></code>
 	  <p>
+	  Requests with more than maxHeaderCount headers, or with a header line longer than maxHeaderLineSize,
+	  are rejected with status 431. A request line longer than maxHeaderLineSize is rejected with status 414.
+	  The header count also applies to HTTP/2 requests.
+	  <p>
 	  MaxRequestSize is the maximum size of a HTTP request. In case of
 	  multipart/form-data requests (also known as file-upload), the maximum
 	  size of the body must not exceed maxMultiPartSize.
 	  The body is always a little larger than the file itself.
+	  <p>
+	  Multipart bodies and uploaded files up to maxMultipartMemorySize are kept
+	  in memory, larger ones are moved to temporary files in tmpDir.
+	  <p>
+	  Bodies sent with Transfer-Encoding: chunked are decoded transparently. Other transfer codings
+	  are rejected with 501 Not Implemented. If
+	  the request handler asks for a streamed body, the body is not collected at
+	  all but can be read through getBodyDevice() while the request is serviced.
+	  Streamed bodies are not limited by maxRequestSize.
+	  <p>
+	  Requests received with HTTP/2 are filled by the Http2Connection, their version is "HTTP/2.0".
 	*/
 
 	class QTWEBAPP_EXPORT HttpRequest {
 		Q_DISABLE_COPY(HttpRequest)
 		friend class HttpSessionStore;
+		friend class HttpConnectionHandler;
+		friend class Http2Connection;
 
 	  public:
 		/** Values for getStatus() */
@@ -117,9 +139,17 @@ namespace qtwebapp {
 		/** Get all HTTP request parameters. */
 		QMultiMap<QByteArray, QByteArray> getParameterMap() const;
 
-		/** Get the HTTP request body.  */
+		/** Get the HTTP request body. This is empty if the body is streamed. */
 		QByteArray getBody() const;
 
+		/**
+		  Get the device to read a streamed body from. Returns nullptr if the body
+		  has not been streamed (use getBody() instead) or if there is no body. The
+		  device belongs to this request.
+		  @see HttpRequestHandler::streamRequestBody()
+		*/
+		HttpRequestBody *getBodyDevice() const;
+
 		/**
 		  Decode an URL parameter.
 		  E.g. replace "%23" by '#' and replace '+' by ' '.
@@ -133,11 +163,25 @@ namespace qtwebapp {
 		  be closed and deleted by the destructor of this HttpRequest
 		  object (after processing the request).
 		  <p>
+		  A file that has been kept in memory is written to a temporary
+		  file first, use getUploadedData() to avoid that.
+		  <p>
 		  For uploaded files, the method getParameters() returns
 		  the original fileName as provided by the calling web browser.
 		*/
 		QFile *getUploadedFile(const QByteArray fieldName) const;
 
+		/**
+		  Get the data of an uploaded file. The device is already open. It will
+		  be closed and deleted by the destructor of this HttpRequest
+		  object (after processing the request).
+		  <p>
+		  Small files are kept in memory, larger files are stored in a
+		  temporary file (see maxMultipartMemorySize). A later call of
+		  getUploadedFile() for the same field replaces the device.
+		*/
+		QIODevice *getUploadedData(const QByteArray fieldName) const;
+
 		/**
 		  Get the value of a cookie.
 		  @param name Name of the cookie
@@ -151,18 +195,33 @@ namespace qtwebapp {
 		  Get the address of the connected client.
 		  Note that multiple clients may have the same IP address, if they
 		  share an internet connection (which is very common).
+		  Connections on a Unix domain socket are reported as coming from QHostAddress::LocalHost.
 		 */
 		QHostAddress getPeerAddress() const;
 
 	  private:
-		/** Request headers */
-		QMultiMap<QByteArray, QByteArray> headers;
+		/** Location of a request header in headerBuffer */
+		struct HeaderEntry {
+			int name;
+			int nameSize;
+			int value;
+			int valueSize;
+		};
+
+		/**
+		  Names (in lower-case) and values of the request headers, stored back to back.
+		  Together with the headers vector, this avoids an allocation for each header.
+		*/
+		QByteArray headerBuffer;
+
+		/** Request headers, in the order of their appearance */
+		QVector<HeaderEntry> headers;
 
 		/** Parameters of the request */
 		QMultiMap<QByteArray, QByteArray> parameters;
 
-		/** Uploaded files of the request, key is the field name. */
-		QMap<QByteArray, QTemporaryFile *> uploadedFiles;
+		/** Uploaded files of the request, key is the field name. Buffers are replaced by getUploadedFile(). */
+		mutable QMap<QByteArray, QIODevice *> uploadedFiles;
 
 		/** Received cookies */
 		QMap<QByteArray, QByteArray> cookies;
@@ -194,24 +253,90 @@ namespace qtwebapp {
 		/** Maximum allowed size of multipart forms in bytes. */
 		int maxMultiPartSize;
 
+		/** Maximum size of multipart forms and uploaded files that are kept in memory. */
+		int maxMultipartMemorySize;
+
+		/** Maximum number of header fields */
+		int maxHeaderCount;
+
+		/** Maximum size of the request line and of each header line */
+		int maxHeaderLineSize;
+
+		/** Whether the request has been aborted because of too many or too long header lines */
+		bool headerTooLarge;
+
+		/** Whether the request has been aborted because of a too long request line */
+		bool uriTooLong;
+
+		/** Whether the request has been aborted because of a transfer coding other than chunked */
+		bool unsupportedEncoding;
+
 		/** Current size */
 		int currentSize;
 
 		/** Expected size of body */
 		int expectedBodySize;
 
-		/** Name of the current header, or empty if no header is being processed */
-		QByteArray currentHeader;
+		/** Whether the body is sent with Transfer-Encoding: chunked */
+		bool chunkedBody;
+
+		/** Whether the body is streamed to the request handler */
+		bool streamedBody;
+
+		/** Maximum time to wait for data of a streamed body */
+		int readTimeout;
+
+		/** Decoder of the body, created once all headers have been received */
+		HttpRequestBody *body;
 
 		/** Boundary of multipart/form-data body. Empty if there is no such header */
 		QByteArray boundary;
 
-		/** Temp file, that is used to store the multipart/form-data body */
-		QTemporaryFile *tempFile;
+		/** Buffer or temp file, that is used to store the multipart/form-data body */
+		QIODevice *multipartBody;
 
-		/** Parse the multipart body, that has been stored in the temp file. */
+		/** Parse the multipart body, that has been stored in the buffer or temp file. */
 		void parseMultiPartFile();
 
+		/**
+		  Write multipart data to an in-memory buffer. If the buffer exceeds maxMultipartMemorySize,
+		  it is replaced by a temp file.
+		  @param device The buffer or temp file, may be replaced
+		  @param data The data to write
+		  @return Whether the data has been written completely
+		*/
+		bool writeMultipartData(QIODevice *&device, const QByteArray &data);
+
+		/**
+		  Reset this object for the next request on the same connection. The buffers
+		  used for parsing keep their capacity.
+		*/
+		void reset();
+
+		/**
+		  Sub-procedure of readFromSocket(), collect the next line in lineBuffer.
+		  @return Whether the line is complete
+		*/
+		bool readLine(QTcpSocket *socket);
+
+		/**
+		  Find a header by its name, searching backwards.
+		  @param name Name of the header, not case-sensitive
+		  @param size Length of the name
+		  @param before Only headers before this index are searched
+		  @return Index in headers, or -1 if not found
+		*/
+		int findHeader(const char *name, int size, int before) const;
+
+		/**
+		  Get the value of a header without copying it. The returned array is
+		  only valid until the request is reset.
+		*/
+		QByteArray rawHeader(const char *name) const;
+
+		/** Compare the value of a header with a string, not case-sensitive. */
+		bool headerEquals(const char *name, const char *value) const;
+
 		/** Sub-procedure of readFromSocket(), read the first line of a request. */
 		void readRequest(QTcpSocket *socket);
 
@@ -221,6 +346,44 @@ namespace qtwebapp {
 		/** Sub-procedure of readFromSocket(), read the request body. */
 		void readBody(QTcpSocket *socket);
 
+		/**
+		  Append received body data to the body or the multipart buffer.
+		  @param data The received data
+		  @param last Whether the body is complete now
+		*/
+		void appendBody(const QByteArray &data, bool last);
+
+		/** Get the boundary of a multipart/form-data body from the Content-Type header */
+		void extractBoundary();
+
+		/** Add a header with a lower-case name */
+		void addHeader(const QByteArray &name, const QByteArray &value);
+
+		/**
+		  Fill the request from the header block of a HTTP/2 stream.
+		  @param fields The decoded header fields, including the pseudo-header fields
+		  @param endStream Whether the stream has no body
+		  @param peer Address of the client
+		  @return False if the request is malformed
+		*/
+		bool readStreamHeaders(const QList<Http2Header> &fields, bool endStream, const QHostAddress &peer);
+
+		/**
+		  Receive body data of a HTTP/2 stream.
+		  @param data The received data
+		  @param endStream Whether the body is complete now
+		*/
+		void readFromStream(const QByteArray &data, bool endStream);
+
+		/**
+		  Prepare for receiving the body after all headers have been received.
+		  This is called by readFromSocket(), or by the connection handler if
+		  it wants to decide about streaming the body.
+		  @param socket Source of the body
+		  @param streamed Whether the body is streamed to the request handler
+		*/
+		void startBody(QTcpSocket *socket, bool streamed);
+
 		/** Sub-procedure of readFromSocket(), extract and decode request parameters. */
 		void decodeRequestParams();
 
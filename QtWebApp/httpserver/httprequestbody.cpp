@@ -0,0 +1,176 @@
+#include "httprequestbody.h"
+
+using namespace qtwebapp;
+
+/** Maximum length of a chunk size or trailer line */
+static const int maxLineSize = 4096;
+
+HttpRequestBody::HttpRequestBody(QTcpSocket *socket, qint64 contentLength, QObject *parent)
+    : QIODevice(parent), socket(socket) {
+	chunked = contentLength < 0;
+	state = chunked ? chunkSize : chunkData;
+	remaining = chunked ? 0 : contentLength;
+	received = 0;
+	readTimeout = 0;
+	failed = false;
+	if (!chunked && remaining == 0) {
+		state = done;
+	}
+	open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+void HttpRequestBody::setReadTimeout(int msec) {
+	readTimeout = msec;
+}
+
+bool HttpRequestBody::isComplete() const {
+	return state == done;
+}
+
+bool HttpRequestBody::hasFailed() const {
+	return failed;
+}
+
+qint64 HttpRequestBody::bytesReceived() const {
+	return received;
+}
+
+bool HttpRequestBody::isSequential() const {
+	return true;
+}
+
+bool HttpRequestBody::atEnd() const {
+	return state == done || failed;
+}
+
+qint64 HttpRequestBody::bytesAvailable() const {
+	if (state != chunkData || failed) {
+		return QIODevice::bytesAvailable();
+	}
+	return qMin(remaining, socket->bytesAvailable()) + QIODevice::bytesAvailable();
+}
+
+bool HttpRequestBody::waitForReadyRead(int msecs) {
+	if (atEnd()) {
+		return false;
+	}
+	return socket->waitForReadyRead(msecs);
+}
+
+qint64 HttpRequestBody::readData(char *data, qint64 maxSize) {
+	qint64 total = 0;
+	while (total == 0 && state != done && !failed) {
+		total = decode(data, maxSize);
+		if (total == 0 && state != done && !failed) {
+			if (readTimeout == 0) {
+				break;
+			}
+			if (!socket->waitForReadyRead(readTimeout)) {
+				fail(socket->state() == QAbstractSocket::ConnectedState ? "read timeout" : "connection lost");
+			}
+		}
+	}
+	if (total == 0 && failed) {
+		return -1;
+	}
+	return total;
+}
+
+qint64 HttpRequestBody::writeData(const char *data, qint64 maxSize) {
+	Q_UNUSED(data)
+	Q_UNUSED(maxSize)
+	return -1;
+}
+
+qint64 HttpRequestBody::decode(char *data, qint64 maxSize) {
+	qint64 total = 0;
+	while (total < maxSize && state != done && !failed && socket->bytesAvailable() > 0) {
+		switch (state) {
+			case chunkData: {
+				qint64 read = socket->read(data + total, qMin(maxSize - total, remaining));
+				if (read < 0) {
+					fail("cannot read from socket");
+					break;
+				}
+				total += read;
+				received += read;
+				remaining -= read;
+				if (remaining == 0) {
+					state = chunked ? chunkDataEnd : done;
+				}
+				break;
+			}
+
+			case chunkSize: {
+				if (!readLine()) {
+					return total;
+				}
+				// Ignore chunk extensions
+				int semicolon = lineBuffer.indexOf(';');
+				QByteArray sizeStr = (semicolon >= 0 ? lineBuffer.left(semicolon) : lineBuffer).trimmed();
+				lineBuffer.clear();
+				bool ok;
+				remaining = sizeStr.toLongLong(&ok, 16);
+				if (!ok || remaining < 0) {
+					fail("invalid chunk size");
+				} else if (remaining == 0) {
+#ifdef SUPERVERBOSE
+					qDebug("HttpRequestBody: received last chunk");
+#endif
+					state = chunkTrailer;
+				} else {
+#ifdef SUPERVERBOSE
+					qDebug("HttpRequestBody: receiving chunk of %lli bytes", remaining);
+#endif
+					state = chunkData;
+				}
+				break;
+			}
+
+			case chunkDataEnd: {
+				if (!readLine()) {
+					return total;
+				}
+				if (!lineBuffer.trimmed().isEmpty()) {
+					fail("missing line break after chunk data");
+				}
+				lineBuffer.clear();
+				state = chunkSize;
+				break;
+			}
+
+			case chunkTrailer: {
+				if (!readLine()) {
+					return total;
+				}
+				// Trailer fields are not supported and ignored, an empty line finishes the body
+				if (lineBuffer.trimmed().isEmpty()) {
+					state = done;
+				}
+				lineBuffer.clear();
+				break;
+			}
+
+			case done:
+				break;
+		}
+	}
+	return total;
+}
+
+bool HttpRequestBody::readLine() {
+	lineBuffer.append(socket->readLine(maxLineSize - lineBuffer.size() + 1));
+	if (lineBuffer.endsWith('\n')) {
+		return true;
+	}
+	if (lineBuffer.size() > maxLineSize) {
+		fail("line of chunked body is too long");
+	}
+	return false;
+}
+
+void HttpRequestBody::fail(const char *reason) {
+	qWarning("HttpRequestBody: %s", reason);
+	failed = true;
+	setErrorString(reason);
+}
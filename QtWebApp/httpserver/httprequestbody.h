@@ -0,0 +1,99 @@
+#pragma once
+
+#include "qtwebappglobal.h"
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QTcpSocket>
+
+namespace qtwebapp {
+
+	/**
+	  Sequential device that delivers the body of a HTTP request as it arrives on
+	  the socket. It understands both bodies with a Content-Length header and bodies
+	  sent with Transfer-Encoding: chunked, the latter are decoded transparently.
+	  <p>
+	  The HttpRequest uses this device internally to collect the body. If the request
+	  handler requests a streamed body (see HttpRequestHandler::streamRequestBody()),
+	  the device is handed out through HttpRequest::getBodyDevice() instead. In that
+	  case read() blocks until data arrives or the readTimeout expires. Because the
+	  data is only taken from the socket when the handler reads it, a slow handler
+	  slows down the client instead of filling up the memory of the server.
+	*/
+	class QTWEBAPP_EXPORT HttpRequestBody : public QIODevice {
+		Q_OBJECT
+		Q_DISABLE_COPY(HttpRequestBody)
+
+	  public:
+		/**
+		  Constructor.
+		  @param socket The socket to read the body from
+		  @param contentLength The size of the body, or -1 if the body is sent in chunked mode
+		  @param parent Parent object
+		*/
+		HttpRequestBody(QTcpSocket *socket, qint64 contentLength, QObject *parent = nullptr);
+
+		/**
+		  Set the maximum amount of time that read() waits for incoming data. A value
+		  of 0 (the default) means that read() never waits and returns only data that
+		  has already been received.
+		*/
+		void setReadTimeout(int msec);
+
+		/** Returns true if the body has been received completely. */
+		bool isComplete() const;
+
+		/** Returns true if the body could not be received, e.g. because of a broken chunk or a timeout. */
+		bool hasFailed() const;
+
+		/** Returns the number of decoded body bytes that have been read so far. */
+		qint64 bytesReceived() const;
+
+		bool isSequential() const override;
+		bool atEnd() const override;
+		qint64 bytesAvailable() const override;
+		bool waitForReadyRead(int msecs) override;
+
+	  protected:
+		qint64 readData(char *data, qint64 maxSize) override;
+		qint64 writeData(const char *data, qint64 maxSize) override;
+
+	  private:
+		/** States of the chunked decoder */
+		enum ChunkState { chunkSize, chunkData, chunkDataEnd, chunkTrailer, done };
+
+		/** Source of the data */
+		QTcpSocket *socket;
+
+		/** Whether the body is sent in chunked mode */
+		bool chunked;
+
+		/** Current state of the decoder */
+		ChunkState state;
+
+		/** Remaining bytes of the body or the current chunk */
+		qint64 remaining;
+
+		/** Number of decoded bytes */
+		qint64 received;
+
+		/** Maximum time to wait for data, 0 means don't wait */
+		int readTimeout;
+
+		/** Whether an error occured */
+		bool failed;
+
+		/** Buffer for collecting characters of chunk size and trailer lines */
+		QByteArray lineBuffer;
+
+		/** Decode as much data as currently available, without waiting. */
+		qint64 decode(char *data, qint64 maxSize);
+
+		/** Collect a line of the chunked framing. Returns false if the line is not complete yet. */
+		bool readLine();
+
+		/** Mark the body as broken. */
+		void fail(const char *reason);
+	};
+
+} // namespace qtwebapp
@@ -7,6 +7,7 @@
 
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "websocket.h"
 #include "qtwebappglobal.h"
 
 namespace qtwebapp {
@@ -40,6 +41,61 @@ namespace qtwebapp {
 		  @warning This method must be thread safe
 		*/
 		virtual void service(HttpRequest &request, HttpResponse &response) = 0;
+
+		/**
+		  Decide whether the body of a request should be streamed. This is called after
+		  all headers of a request with a body have been received. If it returns true,
+		  service() is called immediately and must read the body from
+		  HttpRequest::getBodyDevice(). Streamed bodies are not limited by maxRequestSize
+		  and never held in memory as a whole, which is useful for large uploads. The
+		  default implementation returns false, so the body is collected before service()
+		  is called.
+		  @param request The request, only the request line and headers are available
+		  @warning This method must be thread safe
+		*/
+		virtual bool streamRequestBody(const HttpRequest &request) {
+			Q_UNUSED(request)
+			return false;
+		}
+
+		/**
+		  Decide whether a request with a body is accepted before the body is transferred.
+		  This is called after all headers of a request with a body have been received,
+		  and before the client is told to continue if it sent an Expect: 100-continue header.
+		  If it returns false, the response is sent to the client without receiving the body
+		  and the connection is closed. This can be used to reject unauthorized or oversized
+		  uploads without wasting bandwidth. The default implementation accepts all requests.
+		  @param request The request, only the request line and headers are available
+		  @param response Used to return the rejection. Set the status (e.g. 401 or 413) and
+		  optionally write a body. If the status is not changed, 403 forbidden is sent.
+		  The response must not be written when the request is accepted.
+		  @warning This method must be thread safe
+		*/
+		virtual bool acceptRequest(const HttpRequest &request, HttpResponse &response) {
+			Q_UNUSED(request)
+			Q_UNUSED(response)
+			return true;
+		}
+
+		/**
+		  Decide whether a WebSocket upgrade request is accepted. This is called for GET requests with the
+		  headers of a WebSocket handshake. If it returns true, the connection handler answers with 101 and
+		  hands the connection over to the WebSocket. If it returns false, the WebSocket is deleted and the
+		  request is passed to service() like any other request. The default implementation rejects all
+		  upgrades.
+		  @param request The upgrade request
+		  @param response The 101 response, additional headers like Sec-WebSocket-Protocol may be set. The
+		  response must not be written.
+		  @param webSocket The new WebSocket. Connect its signals before returning true, it deletes itself
+		  when the connection has been closed.
+		  @warning This method must be thread safe
+		*/
+		virtual bool acceptWebSocket(const HttpRequest &request, HttpResponse &response, WebSocket *webSocket) {
+			Q_UNUSED(request)
+			Q_UNUSED(response)
+			Q_UNUSED(webSocket)
+			return false;
+		}
 	};
 
 } // namespace qtwebapp
@@ -5,15 +5,129 @@
 
 #include "httpresponse.h"
 
+#include "http2connection.h"
+#include "httpfilereader.h"
+#include "httppipelinedrequest.h"
+
+#include <QDateTime>
+#include <QLocale>
+#include <QMutex>
+
+#ifndef QT_NO_SSL
+#include <QSslSocket>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#endif
+
 using namespace qtwebapp;
 
+#ifdef Q_OS_LINUX
+/** Hold back partial segments of a socket while corked, sending pending data when uncorked */
+static void setCork(int socketDescriptor, bool enabled) {
+	int value = enabled ? 1 : 0;
+	setsockopt(socketDescriptor, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+}
+#endif
+
+/** Returns the complete status line of common status codes with their standard description, or nullptr */
+static const char *standardStatusLine(int statusCode) {
+	switch (statusCode) {
+		case 100: return "HTTP/1.1 100 Continue\r\n";
+		case 101: return "HTTP/1.1 101 Switching Protocols\r\n";
+		case 200: return "HTTP/1.1 200 OK\r\n";
+		case 201: return "HTTP/1.1 201 Created\r\n";
+		case 202: return "HTTP/1.1 202 Accepted\r\n";
+		case 204: return "HTTP/1.1 204 No Content\r\n";
+		case 206: return "HTTP/1.1 206 Partial Content\r\n";
+		case 301: return "HTTP/1.1 301 Moved Permanently\r\n";
+		case 302: return "HTTP/1.1 302 Found\r\n";
+		case 303: return "HTTP/1.1 303 See Other\r\n";
+		case 304: return "HTTP/1.1 304 Not Modified\r\n";
+		case 307: return "HTTP/1.1 307 Temporary Redirect\r\n";
+		case 308: return "HTTP/1.1 308 Permanent Redirect\r\n";
+		case 400: return "HTTP/1.1 400 Bad Request\r\n";
+		case 401: return "HTTP/1.1 401 Unauthorized\r\n";
+		case 403: return "HTTP/1.1 403 Forbidden\r\n";
+		case 404: return "HTTP/1.1 404 Not Found\r\n";
+		case 405: return "HTTP/1.1 405 Method Not Allowed\r\n";
+		case 406: return "HTTP/1.1 406 Not Acceptable\r\n";
+		case 408: return "HTTP/1.1 408 Request Timeout\r\n";
+		case 409: return "HTTP/1.1 409 Conflict\r\n";
+		case 410: return "HTTP/1.1 410 Gone\r\n";
+		case 411: return "HTTP/1.1 411 Length Required\r\n";
+		case 412: return "HTTP/1.1 412 Precondition Failed\r\n";
+		case 413: return "HTTP/1.1 413 Payload Too Large\r\n";
+		case 414: return "HTTP/1.1 414 URI Too Long\r\n";
+		case 415: return "HTTP/1.1 415 Unsupported Media Type\r\n";
+		case 416: return "HTTP/1.1 416 Range Not Satisfiable\r\n";
+		case 417: return "HTTP/1.1 417 Expectation Failed\r\n";
+		case 422: return "HTTP/1.1 422 Unprocessable Entity\r\n";
+		case 429: return "HTTP/1.1 429 Too Many Requests\r\n";
+		case 500: return "HTTP/1.1 500 Internal Server Error\r\n";
+		case 501: return "HTTP/1.1 501 Not Implemented\r\n";
+		case 502: return "HTTP/1.1 502 Bad Gateway\r\n";
+		case 503: return "HTTP/1.1 503 Service Unavailable\r\n";
+		case 504: return "HTTP/1.1 504 Gateway Timeout\r\n";
+		default: return nullptr;
+	}
+}
+
+/** Returns the Date header line for the current second. The value is formatted once per second for all threads. */
+static QByteArray currentDateLine() {
+	static QMutex mutex;
+	static qint64 cachedSecond = -1;
+	static QByteArray cachedLine;
+	qint64 second = QDateTime::currentMSecsSinceEpoch() / 1000;
+	QMutexLocker locker(&mutex);
+	if (second != cachedSecond) {
+		QDateTime now = QDateTime::fromMSecsSinceEpoch(second * 1000, Qt::UTC);
+		// Day and month names must not be localized
+		cachedLine = "Date: " + QLocale::c().toString(now, "ddd, dd MMM yyyy hh:mm:ss").toLatin1() + " GMT\r\n";
+		cachedSecond = second;
+	}
+	return cachedLine;
+}
+
 HttpResponse::HttpResponse(QTcpSocket *socket) {
 	this->socket = socket;
 	statusCode = 200;
-	statusText = "OK";
 	sentHeaders = false;
 	sentLastPart = false;
 	chunkedMode = false;
+	bufferSize = 0;
+	writeTimeout = -1;
+	http2 = nullptr;
+	streamId = 0;
+	eventChannel = nullptr;
+	pipelined = nullptr;
+	truncated = false;
+	draining = nullptr;
+	statistics = nullptr;
+}
+
+HttpResponse::HttpResponse(QTcpSocket *socket, const HttpServerConfig &cfg) : HttpResponse(socket) {
+	serverHeader = cfg.serverHeader;
+	bufferSize = cfg.responseBufferSize;
+	writeTimeout = cfg.writeTimeout;
+}
+
+HttpResponse::HttpResponse(Http2Connection *connection, quint32 streamId, const HttpServerConfig &cfg)
+    : HttpResponse(connection->getSocket(), cfg) {
+	http2 = connection;
+	statistics = connection->statistics;
+	this->streamId = streamId;
+}
+
+HttpResponse::HttpResponse(HttpPipelinedRequest *pipelined, const HttpServerConfig &cfg)
+    : HttpResponse(static_cast<QTcpSocket *>(nullptr), cfg) {
+	this->pipelined = pipelined;
 }
 
 void HttpResponse::setHeader(QByteArray name, QByteArray value) {
@@ -41,36 +155,108 @@ int HttpResponse::getStatusCode() const {
 
 void HttpResponse::writeHeaders() {
 	Q_ASSERT(sentHeaders == false);
+	const char *statusLine = statusText.isEmpty() ? standardStatusLine(statusCode) : nullptr;
+	QByteArray dateLine = headers.contains("Date") ? QByteArray() : currentDateLine();
+	QList<QByteArray> cookieLines;
+	for (QMap<QByteArray, HttpCookie>::const_iterator it = cookies.constBegin(); it != cookies.constEnd(); ++it) {
+		cookieLines.append(it.value().toByteArray());
+	}
+
+	// Calculate the size of the headers, so the buffer needs to be allocated only once
+	int size = (statusLine ? int(qstrlen(statusLine)) : 16 + statusText.size()) + dateLine.size() + 2;
+	if (!serverHeader.isEmpty()) {
+		size += 10 + serverHeader.size();
+	}
+	for (QMap<QByteArray, QByteArray>::const_iterator it = headers.constBegin(); it != headers.constEnd(); ++it) {
+		size += it.key().size() + it.value().size() + 4;
+	}
+	foreach (const QByteArray &cookieLine, cookieLines) {
+		size += 14 + cookieLine.size();
+	}
+
 	QByteArray buffer;
-	buffer.append("HTTP/1.1 ");
-	buffer.append(QByteArray::number(statusCode));
-	buffer.append(' ');
-	buffer.append(statusText);
-	buffer.append("\r\n");
-	foreach (QByteArray name, headers.keys()) {
-		buffer.append(name);
+	buffer.reserve(size);
+	if (statusLine) {
+		buffer.append(statusLine);
+	} else {
+		buffer.append("HTTP/1.1 ");
+		buffer.append(QByteArray::number(statusCode));
+		buffer.append(' ');
+		buffer.append(statusText.isEmpty() ? QByteArray("Unknown") : statusText);
+		buffer.append("\r\n");
+	}
+	buffer.append(dateLine);
+	if (!serverHeader.isEmpty()) {
+		buffer.append("Server: ");
+		buffer.append(serverHeader);
+		buffer.append("\r\n");
+	}
+	for (QMap<QByteArray, QByteArray>::const_iterator it = headers.constBegin(); it != headers.constEnd(); ++it) {
+		buffer.append(it.key());
 		buffer.append(": ");
-		buffer.append(headers.value(name));
+		buffer.append(it.value());
 		buffer.append("\r\n");
 	}
-	foreach (HttpCookie cookie, cookies.values()) {
+	foreach (const QByteArray &cookieLine, cookieLines) {
 		buffer.append("Set-Cookie: ");
-		buffer.append(cookie.toByteArray());
+		buffer.append(cookieLine);
 		buffer.append("\r\n");
 	}
 	buffer.append("\r\n");
 	writeToSocket(buffer);
-	socket->flush();
 	sentHeaders = true;
 }
 
-bool HttpResponse::writeToSocket(QByteArray data) {
+void HttpResponse::closeIfDraining() {
+	// HTTP/2 connections are closed with GOAWAY instead
+	if (http2 == nullptr && draining && draining->loadAcquire()) {
+		headers.insert("Connection", "close");
+	}
+}
+
+void HttpResponse::writeHttp2Headers(bool endStream) {
+	Q_ASSERT(sentHeaders == false);
+	QList<Http2Header> fields;
+	fields.reserve(headers.size() + cookies.size() + 3);
+	fields.append(Http2Header(":status", QByteArray::number(statusCode)));
+	if (!headers.contains("Date")) {
+		// The cached header line without "Date: " and the line break
+		QByteArray dateLine = currentDateLine();
+		fields.append(Http2Header("date", dateLine.mid(6, dateLine.size() - 8)));
+	}
+	if (!serverHeader.isEmpty()) {
+		fields.append(Http2Header("server", serverHeader));
+	}
+	// HTTP/2 requires lower-case names and does not allow connection-specific headers
+	for (QMap<QByteArray, QByteArray>::const_iterator it = headers.constBegin(); it != headers.constEnd(); ++it) {
+		QByteArray name = it.key().toLower();
+		if (name == "connection" || name == "keep-alive" || name == "proxy-connection" || name == "transfer-encoding" ||
+		    name == "upgrade") {
+			continue;
+		}
+		fields.append(Http2Header(name, it.value()));
+	}
+	for (QMap<QByteArray, HttpCookie>::const_iterator it = cookies.constBegin(); it != cookies.constEnd(); ++it) {
+		fields.append(Http2Header("set-cookie", it.value().toByteArray()));
+	}
+	http2->sendHeaders(streamId, fields, endStream);
+	sentHeaders = true;
+}
+
+bool HttpResponse::writeToSocket(const QByteArray &data) {
+	if (pipelined) {
+		return pipelined->append(data);
+	}
 	int remaining = data.size();
-	char *ptr = data.data();
+	const char *ptr = data.constData();
 	while (socket->isOpen() && remaining > 0) {
 		// If the output buffer has become large, then wait until it has been sent.
 		if (socket->bytesToWrite() > 16384) {
-			socket->waitForBytesWritten(-1);
+			if (!socket->waitForBytesWritten(writeTimeout) && socket->bytesToWrite() > 16384) {
+				qWarning("HttpResponse: write timeout, closing the connection");
+				socket->abort();
+				return false;
+			}
 		}
 
 		qint64 written = socket->write(ptr, remaining);
@@ -86,17 +272,39 @@ bool HttpResponse::writeToSocket(QByteArray data) {
 void HttpResponse::write(QByteArray data, bool lastPart) {
 	Q_ASSERT(sentLastPart == false);
 
+	// In buffered mode, collect small writes until the buffer is full or the last part arrives
+	if (bufferSize > 0) {
+		if (!lastPart && bodyBuffer.size() + data.size() < bufferSize) {
+			bodyBuffer.append(data);
+			return;
+		}
+		if (!bodyBuffer.isEmpty()) {
+			bodyBuffer.append(data);
+			data = bodyBuffer;
+			bodyBuffer.clear();
+		}
+	}
+
+	sendBody(data, lastPart);
+}
+
+void HttpResponse::sendBody(const QByteArray &data, bool lastPart) {
+	bool firstPart = !sentHeaders;
 	// Send HTTP headers, if not already done (that happens only on the first call to write())
 	if (sentHeaders == false) {
+		closeIfDraining();
+
 		// If the whole response is generated with a single call to write(), then we know the total
 		// size of the response and therefore can set the Content-Length header automatically.
 		if (lastPart) {
-			// Automatically set the Content-Length header
-			headers.insert("Content-Length", QByteArray::number(data.size()));
+			// Automatically set the Content-Length header, informational responses have no body
+			if (statusCode >= 200) {
+				headers.insert("Content-Length", QByteArray::number(data.size()));
+			}
 		}
 
 		// else if we will not close the connection at the end, them we must use the chunked mode.
-		else {
+		else if (http2 == nullptr) {
 			QByteArray connectionValue = headers.value("Connection", headers.value("connection"));
 			bool connectionClose = QString::compare(connectionValue, "close", Qt::CaseInsensitive) == 0;
 			if (!connectionClose) {
@@ -105,32 +313,172 @@ void HttpResponse::write(QByteArray data, bool lastPart) {
 			}
 		}
 
-		writeHeaders();
+		if (http2 == nullptr) {
+			writeHeaders();
+		} else {
+			// A response without body ends with the HEADERS frame
+			bool endStream = lastPart && data.isEmpty();
+			writeHttp2Headers(endStream);
+			if (endStream) {
+				sentLastPart = true;
+				return;
+			}
+		}
 	}
 
 	// Send data
-	if (data.size() > 0) {
-		if (chunkedMode) {
+	if (http2) {
+		http2->sendData(streamId, data, lastPart);
+	} else if (chunkedMode) {
+		// Small chunks are sent together with their framing and the terminating marker
+		if (data.size() <= 16384) {
+			QByteArray chunk;
+			chunk.reserve(data.size() + 20);
 			if (data.size() > 0) {
-				QByteArray size = QByteArray::number(data.size(), 16);
-				writeToSocket(size);
-				writeToSocket("\r\n");
-				writeToSocket(data);
-				writeToSocket("\r\n");
+				chunk.append(QByteArray::number(data.size(), 16));
+				chunk.append("\r\n");
+				chunk.append(data);
+				chunk.append("\r\n");
+			}
+			if (lastPart) {
+				chunk.append("0\r\n\r\n");
 			}
+			writeToSocket(chunk);
 		} else {
+			writeToSocket(QByteArray::number(data.size(), 16) + "\r\n");
 			writeToSocket(data);
+			writeToSocket(lastPart ? "\r\n0\r\n\r\n" : "\r\n");
 		}
+	} else if (data.size() > 0) {
+		writeToSocket(data);
 	}
 
-	// Only for the last chunk, send the terminating marker and flush the buffer.
+	// Only for the last chunk, flush the buffer. A streamed body starts with the headers in the same write.
 	if (lastPart) {
-		if (chunkedMode) {
-			writeToSocket("0\r\n\r\n");
-		}
-		socket->flush();
+		flushSocket();
 		sentLastPart = true;
+	} else if (firstPart && http2 == nullptr) {
+		flushSocket();
+	}
+}
+
+bool HttpResponse::writeFile(QFile &file) {
+	Q_ASSERT(sentHeaders == false);
+	if (http2) {
+		// HTTP/2 needs DATA frames, so the file is passed to write() in blocks
+		qint64 remaining = file.size() - file.pos();
+		headers.insert("Content-Length", QByteArray::number(remaining));
+		{
+			HttpFileReader reader(file, remaining, 65536, statistics);
+			while (remaining > 0) {
+				QByteArray buffer = reader.read();
+				if (buffer.isEmpty()) {
+					break;
+				}
+				write(buffer);
+				remaining -= buffer.size();
+			}
+		}
+		write(QByteArray(), true);
+		return remaining == 0;
+	}
+
+	// The Content-Length header marks the end of the body, so chunked mode is not needed
+	qint64 remaining = file.size() - file.pos();
+	bodyBuffer.clear();
+	headers.remove("Transfer-Encoding");
+	headers.insert("Content-Length", QByteArray::number(remaining));
+	closeIfDraining();
+	writeHeaders();
+
+	if (!sendFileZeroCopy(file, remaining)) {
+		HttpFileReader reader(file, remaining, 65536, statistics);
+		while (remaining > 0) {
+			QByteArray buffer = reader.read();
+			if (buffer.isEmpty() || !writeToSocket(buffer)) {
+				break;
+			}
+			remaining -= buffer.size();
+		}
+	}
+	flushSocket();
+	sentLastPart = true;
+	if (remaining > 0) {
+		// The client cannot detect the end of a truncated body otherwise
+		qWarning("HttpResponse: cannot send file %s completely", qPrintable(file.fileName()));
+		if (pipelined) {
+			// The connection handler aborts the connection after the responses of the previous requests
+			truncated = true;
+		} else {
+			socket->abort();
+		}
+		return false;
 	}
+	return true;
+}
+
+bool HttpResponse::sendFileZeroCopy(QFile &file, qint64 &remaining) {
+#ifdef Q_OS_LINUX
+	if (pipelined) {
+		return false;
+	}
+#ifndef QT_NO_SSL
+	// Encrypted data must pass through the SSL socket
+	QSslSocket *sslSocket = qobject_cast<QSslSocket *>(socket);
+	if (sslSocket && sslSocket->mode() != QSslSocket::UnencryptedMode) {
+		return false;
+	}
+#endif
+	int fileDescriptor = file.handle();
+	int socketDescriptor = int(socket->socketDescriptor());
+	if (fileDescriptor < 0 || socketDescriptor < 0 || remaining == 0) {
+		return false;
+	}
+
+	// The headers must have left the buffer of the socket before the kernel sends the file. The socket is
+	// corked meanwhile, so that a small file shares its segment with the headers.
+	setCork(socketDescriptor, true);
+	while (socket->bytesToWrite() > 0) {
+		if (!socket->waitForBytesWritten(writeTimeout)) {
+			setCork(socketDescriptor, false);
+			return true;
+		}
+	}
+
+	off_t offset = file.pos();
+	bool started = false;
+	while (remaining > 0) {
+		ssize_t sent = ::sendfile(socketDescriptor, fileDescriptor, &offset, size_t(qMin(remaining, qint64(1) << 30)));
+		if (sent > 0) {
+			remaining -= sent;
+			started = true;
+		} else if (sent < 0 && errno == EINTR) {
+			continue;
+		} else if (sent < 0 && errno == EAGAIN) {
+			// The socket is non-blocking, wait until the client has received some data
+			struct pollfd pollDescriptor;
+			pollDescriptor.fd = socketDescriptor;
+			pollDescriptor.events = POLLOUT;
+			pollDescriptor.revents = 0;
+			if (::poll(&pollDescriptor, 1, writeTimeout) <= 0) {
+				break;
+			}
+		} else if (sent < 0 && !started && (errno == EINVAL || errno == ENOSYS)) {
+			// The file system or the socket does not support sendfile()
+			setCork(socketDescriptor, false);
+			return false;
+		} else {
+			break;
+		}
+	}
+	setCork(socketDescriptor, false);
+	file.seek(offset);
+	return true;
+#else
+	Q_UNUSED(file)
+	Q_UNUSED(remaining)
+	return false;
+#endif
 }
 
 bool HttpResponse::hasSentLastPart() const {
@@ -149,15 +497,30 @@ QMap<QByteArray, HttpCookie> &HttpResponse::getCookies() {
 }
 
 void HttpResponse::redirect(const QByteArray &url) {
-	setStatus(303, "See Other");
+	setStatus(303);
 	setHeader("Location", url);
 	write("Redirect", true);
 }
 
 void HttpResponse::flush() {
-	socket->flush();
+	if (!bodyBuffer.isEmpty()) {
+		QByteArray data = bodyBuffer;
+		bodyBuffer.clear();
+		sendBody(data, false);
+	}
+	flushSocket();
+}
+
+void HttpResponse::flushSocket() {
+	if (!pipelined) {
+		socket->flush();
+	}
 }
 
 bool HttpResponse::isConnected() const {
+	// The socket must not be used by the thread pool
+	if (pipelined) {
+		return pipelined->buffer->connected.loadAcquire() != 0;
+	}
 	return socket->isOpen();
 }
@@ -5,15 +5,24 @@
 
 #pragma once
 
+#include "http2hpack.h"
 #include "httpcookie.h"
+#include "httpserverconfig.h"
+#include "httpserverstatistics.h"
 #include "qtwebappglobal.h"
 
+#include <QAtomicInt>
+#include <QFile>
 #include <QMap>
 #include <QString>
 #include <QTcpSocket>
 
 namespace qtwebapp {
 
+	class EventChannel;
+	class Http2Connection;
+	class HttpPipelinedRequest;
+
 	/**
 	  This object represents a HTTP response, used to return something to the web client.
 	  <p>
@@ -31,10 +40,18 @@ namespace qtwebapp {
 	  <p>
 	  In case of large responses (e.g. file downloads), a Content-Length header should be set
 	  before calling write(). Web Browsers use that information to display a progress bar.
+	  <p>
+	  If responseBufferSize is configured, small writes are collected until the buffer is full.
+	  A response that fits into the buffer is sent with a Content-Length header instead of
+	  chunked mode, larger responses are sent in chunks of about the buffer size.
 	*/
 
 	class QTWEBAPP_EXPORT HttpResponse {
 		Q_DISABLE_COPY(HttpResponse)
+		friend class EventChannel;
+		friend class HttpConnectionHandler;
+		friend class HttpPipelinedRequest;
+
 	  public:
 		/**
 		  Constructor.
@@ -42,6 +59,21 @@ namespace qtwebapp {
 		*/
 		HttpResponse(QTcpSocket *socket);
 
+		/**
+		  Constructor.
+		  @param socket used to write the response
+		  @param cfg Configuration of the HTTP server, used for the Server header and the response buffer
+		*/
+		HttpResponse(QTcpSocket *socket, const HttpServerConfig &cfg);
+
+		/**
+		  Constructor for a response that is sent on a HTTP/2 stream.
+		  @param connection The HTTP/2 connection
+		  @param streamId The stream of the request
+		  @param cfg Configuration of the HTTP server
+		*/
+		HttpResponse(Http2Connection *connection, quint32 streamId, const HttpServerConfig &cfg);
+
 		/**
 		  Set a HTTP response header.
 		  You must call this method before the first write().
@@ -66,6 +98,7 @@ namespace qtwebapp {
 
 		/**
 		  Set status code and description. The default is 200,OK.
+		  If no description is given, the standard description of the status code is used.
 		  You must call this method before the first write().
 		*/
 		void setStatus(const int statusCode, const QByteArray description = QByteArray());
@@ -82,12 +115,24 @@ namespace qtwebapp {
 		  then a Content-Length header is automatically set.
 		  <p>
 		  Chunked mode is automatically selected if there is no Content-Length header
-		  and also no Connection:close header.
+		  and also no Connection:close header. HTTP/2 responses are sent in DATA frames instead.
 		  @param data Data bytes of the body
 		  @param lastPart Indicates that this is the last chunk of data and flushes the output buffer.
 		*/
 		void write(const QByteArray data, const bool lastPart = false);
 
+		/**
+		  Send the rest of an open file as the complete body, with a Content-Length header. This must be
+		  called instead of write(), the response is finished afterwards.
+		  <p>
+		  On Linux, files are sent with sendfile() on unencrypted HTTP/1.x connections, so the data is not
+		  copied through the application. Otherwise, or if the kernel cannot send the file, it is read and
+		  written in blocks, see HttpFileReader.
+		  @param file A file that has been opened for reading
+		  @return False if the file could not be sent completely
+		*/
+		bool writeFile(QFile &file);
+
 		/**
 		  Indicates whether the body has been sent completely (write() has been called with lastPart=true).
 		*/
@@ -107,7 +152,7 @@ namespace qtwebapp {
 		void redirect(const QByteArray &url);
 
 		/**
-		 * Flush the output buffer (of the underlying socket).
+		 * Flush the output buffer (the response buffer and the one of the underlying socket).
 		 * You normally don't need to call this method because flush is
 		 * automatically called after HttpRequestHandler::service() returns.
 		 */
@@ -129,9 +174,12 @@ namespace qtwebapp {
 		/** HTTP status code*/
 		int statusCode;
 
-		/** HTTP status code description */
+		/** HTTP status code description, or empty to use the standard description */
 		QByteArray statusText;
 
+		/** Value of the Server header, or empty to send no Server header */
+		QByteArray serverHeader;
+
 		/** Indicator whether headers have been sent */
 		bool sentHeaders;
 
@@ -141,18 +189,80 @@ namespace qtwebapp {
 		/** Whether the response is sent in chunked mode */
 		bool chunkedMode;
 
+		/** Size of the response buffer, 0 if writes are not buffered */
+		int bufferSize;
+
+		/** Maximum time to wait until the client receives more data, -1 to wait forever */
+		int writeTimeout;
+
+		/** Body data collected in buffered mode, not yet sent */
+		QByteArray bodyBuffer;
+
+		/** HTTP/2 connection, or nullptr for HTTP/1.x */
+		Http2Connection *http2;
+
+		/** HTTP/2 stream of the response */
+		quint32 streamId;
+
+		/** The channel of Server-Sent Events that this response has been subscribed to, or nullptr */
+		EventChannel *eventChannel;
+
 		/** Cookies */
 		QMap<QByteArray, HttpCookie> cookies;
 
+		/** Collects the response of a pipelined request instead of the socket, or nullptr */
+		HttpPipelinedRequest *pipelined;
+
+		/** Whether the response in the output could not be completed, so the connection must be aborted */
+		bool truncated;
+
+		/** Set by the connection handler when the server shuts down, or nullptr */
+		const QAtomicInt *draining;
+
+		/** Counters of the server, or nullptr */
+		HttpServerStatistics *statistics;
+
+		/**
+		  Constructor for a pipelined request that is serviced in another thread. The response is collected
+		  in memory and sent by the connection handler in the order of the requests. It does not access the
+		  socket, which belongs to the thread of the connection handler.
+		  @param pipelined Collects the response
+		  @param cfg Configuration of the HTTP server
+		*/
+		HttpResponse(HttpPipelinedRequest *pipelined, const HttpServerConfig &cfg);
+
+		/** Flush the socket, unless the response is collected in memory */
+		void flushSocket();
+
 		/** Write raw data to the socket. This method blocks until all bytes have been passed to the TCP buffer */
-		bool writeToSocket(QByteArray data);
+		bool writeToSocket(const QByteArray &data);
+
+		/** Send body data, including the headers before the first part and the chunked framing. */
+		void sendBody(const QByteArray &data, bool lastPart);
+
+		/**
+		  Send a file with sendfile(), after the headers have been sent.
+		  @param remaining Set to the number of bytes that have not been sent
+		  @return False if the kernel does not support sendfile() for the file, before anything has been sent
+		*/
+		bool sendFileZeroCopy(QFile &file, qint64 &remaining);
 
 		/**
 		  Write the response HTTP status and headers to the socket.
 		  Calling this method is optional, because writeBody() calls
-		  it automatically when required.
+		  it automatically when required. The headers are not flushed, so that they leave
+		  together with the first part of the body.
 		*/
 		void writeHeaders();
+
+		/**
+		  Send the response status and headers in a HTTP/2 HEADERS frame.
+		  @param endStream Whether the response has no body
+		*/
+		void writeHttp2Headers(bool endStream);
+
+		/** Add Connection: close before the headers are sent, if the server has started to shut down */
+		void closeIfDraining();
 	};
 
 } // namespace qtwebapp
@@ -1,5 +1,8 @@
 #include "httpserverconfig.h"
 
+#include <QUrl>
+#include <QUrlQuery>
+
 using namespace qtwebapp;
 
 HttpServerConfig::HttpServerConfig() {}
@@ -21,17 +24,80 @@ void HttpServerConfig::parseSettings(const QSettings &settings) {
 	QString hoststr = settings.value("host").toString();
 	host = hoststr.isEmpty() ? QHostAddress::Any : QHostAddress(hoststr);
 	port = settings.value("port", port).toUInt();
+	unixSocket = settings.value("unixSocket").toString();
+	foreach (const QString &entry, settings.value("endpoints").toStringList()) {
+		QUrl url(entry.trimmed());
+		if (!url.isValid() || (url.scheme() != "http" && url.scheme() != "https") || url.port() <= 0) {
+			qWarning("HttpServerConfig: invalid endpoint %s", qPrintable(entry));
+			continue;
+		}
+		HttpEndpointConfig endpoint;
+		if (!url.host().isEmpty()) {
+			endpoint.host = QHostAddress(url.host());
+		}
+		endpoint.port = quint16(url.port());
+		endpoint.ssl = url.scheme() == "https";
+		QUrlQuery query(url);
+		endpoint.sslKeyFile = query.queryItemValue("key", QUrl::FullyDecoded);
+		endpoint.sslCertFile = query.queryItemValue("cert", QUrl::FullyDecoded);
+		endpoints.append(endpoint);
+	}
 
 	maxRequestSize = parseNum(settings.value("maxRequestSize", maxRequestSize), 1024);
+	maxHeaderCount = parseNum(settings.value("maxHeaderCount", maxHeaderCount));
+	maxHeaderLineSize = parseNum(settings.value("maxHeaderLineSize", maxHeaderLineSize), 1024);
 	maxMultipartSize = parseNum(settings.value("maxMultipartSize", maxMultipartSize), 1024);
+	maxMultipartMemorySize = parseNum(settings.value("maxMultipartMemorySize", maxMultipartMemorySize), 1024);
+	streamBufferSize = parseNum(settings.value("streamBufferSize", streamBufferSize), 1024);
+	pipelineConcurrency = parseNum(settings.value("pipelineConcurrency", pipelineConcurrency));
+	pipelineThreads = parseNum(settings.value("pipelineThreads", pipelineThreads));
+	pipelineBufferSize = parseNum(settings.value("pipelineBufferSize", pipelineBufferSize), 1024);
+
+	readTimeout = parseNum(settings.value("readTimeout", readTimeout));
+	minBodyRate = parseNum(settings.value("minBodyRate", minBodyRate), 1024);
+	headerTimeout = parseNum(settings.value("headerTimeout", headerTimeout));
+	keepAliveTimeout = parseNum(settings.value("keepAliveTimeout", keepAliveTimeout));
+	writeTimeout = parseNum(settings.value("writeTimeout", writeTimeout));
 
 	cleanupInterval = parseNum(settings.value("cleanupInterval", cleanupInterval));
 
 	minThreads = parseNum(settings.value("minThreads", minThreads));
 	maxThreads = parseNum(settings.value("maxThreads", maxThreads));
 
+	acceptQueueSize = parseNum(settings.value("acceptQueueSize", acceptQueueSize));
+	acceptQueueTimeout = parseNum(settings.value("acceptQueueTimeout", acceptQueueTimeout));
+	acceptQueueTarget = parseNum(settings.value("acceptQueueTarget", acceptQueueTarget));
+	acceptQueueInterval = parseNum(settings.value("acceptQueueInterval", acceptQueueInterval));
+	retryAfter = parseNum(settings.value("retryAfter", retryAfter));
+	acceptThread = settings.value("acceptThread", acceptThread).toBool();
+
+	listenBacklog = parseNum(settings.value("listenBacklog", listenBacklog));
+	tcpDeferAccept = parseNum(settings.value("tcpDeferAccept", tcpDeferAccept));
+	tcpFastOpen = parseNum(settings.value("tcpFastOpen", tcpFastOpen));
+	socketSendBufferSize = parseNum(settings.value("socketSendBufferSize", socketSendBufferSize), 1024);
+	socketReceiveBufferSize = parseNum(settings.value("socketReceiveBufferSize", socketReceiveBufferSize), 1024);
+	tcpNoDelay = settings.value("tcpNoDelay", tcpNoDelay).toBool();
+
+	maxConnectionsPerClient = parseNum(settings.value("maxConnectionsPerClient", maxConnectionsPerClient));
+	clientRequestRate = parseNum(settings.value("clientRequestRate", clientRequestRate));
+	clientRequestBurst = parseNum(settings.value("clientRequestBurst", clientRequestBurst));
+
+	http2 = settings.value("http2", http2).toBool();
+	http2MaxConcurrentStreams = parseNum(settings.value("http2MaxConcurrentStreams", http2MaxConcurrentStreams));
+
+	webSocketMaxMessageSize = parseNum(settings.value("webSocketMaxMessageSize", webSocketMaxMessageSize), 1024);
+	webSocketWriteBufferSize = parseNum(settings.value("webSocketWriteBufferSize", webSocketWriteBufferSize), 1024);
+
+	responseBufferSize = parseNum(settings.value("responseBufferSize", responseBufferSize), 1024);
+	serverHeader = settings.value("serverHeader", serverHeader).toByteArray();
+
 	sslKeyFile = settings.value("sslKeyFile").toString();
 	sslCertFile = settings.value("sslCertFile").toString();
+	sslAutoReload = settings.value("sslAutoReload", sslAutoReload).toBool();
+
+	drainTimeout = parseNum(settings.value("drainTimeout", drainTimeout));
+	systemdSocket = settings.value("systemdSocket", systemdSocket).toBool();
+	handoffSocket = settings.value("handoffSocket").toString();
 }
 
 // ###########################################################################################
@@ -3,6 +3,7 @@
 #include "qtwebappglobal.h"
 
 #include <QHostAddress>
+#include <QList>
 #include <QSettings>
 #include <QStandardPaths>
 
@@ -10,6 +11,20 @@ namespace qtwebapp {
 	class HttpConnectionHandlerPool;
 	class StaticFileController;
 
+	/**
+	 * An additional address of a `HttpListener`, see `HttpServerConfig::endpoints`.
+	 */
+	struct QTWEBAPP_EXPORT HttpEndpointConfig {
+		/// The address to listen on.
+		QHostAddress host = QHostAddress::Any;
+		/// The port to listen on.
+		quint16 port = 0;
+		/// Whether connections are encrypted with SSL (HTTPS).
+		bool ssl = false;
+		/// The SSL files of this endpoint. If empty, the sslKeyFile and sslCertFile of the server are used.
+		QString sslKeyFile, sslCertFile;
+	};
+
 	/**
 	 * This class stores all configuration information for the `HttpListener`
 	 * class. It can be either created as a standard object and filled from
@@ -31,14 +46,48 @@ namespace qtwebapp {
 		QHostAddress host = QHostAddress::Any;
 		/// The port for the server to listen on.
 		quint16 port = 0;
+		/// Path of a Unix domain socket to listen on instead of host and port, e.g. for a reverse proxy on the
+		/// same machine. The permissions of the socket file follow the umask of the process.
+		QString unixSocket;
+		/// Additional addresses to listen on, served by the same connection handlers. In a config file, they
+		/// are given as URLs, e.g. "http://127.0.0.1:8081, https://0.0.0.0:8443?key=ssl/my.key&cert=ssl/my.cert".
+		QList<HttpEndpointConfig> endpoints;
 
 		/// The maximum size of an HTTP request.
 		int maxRequestSize = 16e3;
+		/// The maximum number of header fields of a request.
+		int maxHeaderCount = 100;
+		/// The maximum size of the request line and of each header line.
+		int maxHeaderLineSize = 8192;
 		/// The maximum size of a body of a multipart/form-data request.
 		int maxMultipartSize = 1e6;
+		/// The maximum size of a multipart/form-data body or uploaded file that is kept in memory. Larger
+		/// ones are stored in temporary files.
+		int maxMultipartMemorySize = 16e3;
 
-		/// The maximum amount of time to wait for an HTTP request to complete.
+		/// The maximum amount of time to wait for the first request of a connection, and for each part of a
+		/// request body.
 		int readTimeout = 1e4;
+		/// The minimum average rate of a request body in bytes per second, after the first readTimeout
+		/// milliseconds. 0 disables the limit.
+		int minBodyRate = 0;
+		/// The maximum amount of time from the first byte of a request until all headers have been received.
+		int headerTimeout = 1e4;
+		/// The maximum amount of time to keep an idle connection open between requests.
+		int keepAliveTimeout = 1e4;
+		/// The maximum amount of time to wait until a client receives more data of a response.
+		int writeTimeout = 6e4;
+
+		/// The amount of data buffered by the socket while a request body is streamed to the request handler.
+		int streamBufferSize = 65536;
+
+		/// The maximum number of pipelined GET and HEAD requests of a connection that are serviced concurrently.
+		/// The responses are still sent in the order of the requests. 0 or 1 services them one after the other.
+		int pipelineConcurrency = 0;
+		/// The number of threads that service pipelined requests, shared by all connections of the pool.
+		int pipelineThreads = 4;
+		/// The maximum amount of response data that the pipelined requests of a connection collect in memory.
+		int pipelineBufferSize = 1048576;
 
 		/// The interval to search for idle connection handlers and kill them.
 		int cleanupInterval = 1e3;
@@ -47,8 +96,75 @@ namespace qtwebapp {
 		/// The maximum amount of connection handlers.
 		int maxThreads = 100;
 
+		/// The maximum number of accepted connections that wait for a free connection handler. 0 rejects
+		/// connections immediately when all handlers are busy.
+		int acceptQueueSize = 100;
+		/// The maximum amount of time a connection waits for a free connection handler.
+		int acceptQueueTimeout = 1e3;
+		/// The tolerated waiting time in the accept queue. If it is exceeded for longer than
+		/// acceptQueueInterval, waiting connections are rejected at an increasing rate (CoDel).
+		int acceptQueueTarget = 50;
+		/// The interval of the overload detection of the accept queue.
+		int acceptQueueInterval = 500;
+		/// The number of seconds in the Retry-After header of rejected connections and requests.
+		int retryAfter = 1;
+		/// Whether the listener accepts connections in a thread of its own instead of the thread that created it.
+		bool acceptThread = false;
+
+		/// The maximum number of connections that the operating system queues until they are accepted, 0 for the
+		/// default of Qt.
+		int listenBacklog = 0;
+		/// The number of seconds the operating system waits for the first data of a connection before it is
+		/// accepted, so that connection handlers are not woken up for empty connections. 0 disables. Linux only.
+		int tcpDeferAccept = 0;
+		/// The maximum number of pending TCP Fast Open requests, 0 disables TCP Fast Open. Linux only.
+		int tcpFastOpen = 0;
+		/// The size of the kernel send buffer of each connection, 0 for the system default.
+		int socketSendBufferSize = 0;
+		/// The size of the kernel receive buffer of each connection, 0 for the system default.
+		int socketReceiveBufferSize = 0;
+		/// Whether Nagle's algorithm is disabled, so that small responses are sent without delay.
+		bool tcpNoDelay = false;
+
+		/// The maximum number of concurrent connections from one client IP address, 0 for unlimited.
+		int maxConnectionsPerClient = 0;
+		/// The number of requests per second allowed from one client IP address, 0 for unlimited.
+		int clientRequestRate = 0;
+		/// The number of requests a client may send at once above its rate, 0 for clientRequestRate.
+		int clientRequestBurst = 0;
+
+		/// Whether HTTP/2 is supported, with prior knowledge (h2c) or negotiated with ALPN over SSL.
+		bool http2 = false;
+		/// The maximum number of concurrent HTTP/2 streams on a connection.
+		int http2MaxConcurrentStreams = 100;
+
+		/// The maximum size of a received WebSocket message, after decompression.
+		int webSocketMaxMessageSize = 1e6;
+		/// The maximum amount of data queued for sending to a WebSocket client. A client that does not read
+		/// fast enough is disconnected.
+		int webSocketWriteBufferSize = 1e6;
+
+		/// The size of the buffer that collects small writes to a response. Responses that fit into the buffer
+		/// are sent with a Content-Length header instead of chunked mode. 0 disables the buffer.
+		int responseBufferSize = 0;
+
+		/// The value of the Server header sent with every response. No Server header is sent if empty.
+		QByteArray serverHeader;
+
 		/// The file required for SSL support.
 		QString sslKeyFile, sslCertFile;
+		/// Whether the SSL key and certificate files are loaded again when they change.
+		bool sslAutoReload = false;
+
+		/// The maximum time to wait for requests in progress when the listener is drained.
+		int drainTimeout = 3e4;
+		/// Whether the listening socket is passed by systemd (socket activation) instead of being bound.
+		/// Not supported together with endpoints, it is ignored then.
+		bool systemdSocket = false;
+		/// Path of a local socket that passes the listening socket to the next process of the server. The new
+		/// process takes over the socket on start, and the previous process is drained. Not supported
+		/// together with endpoints, it is ignored then.
+		QString handoffSocket;
 
 		// Temporary directory
 		QString tmpDir = QStandardPaths::writableLocation(QStandardPaths::TempLocation);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "qtwebappglobal.h"
+
+#include <QAtomicInteger>
+
+namespace qtwebapp {
+
+	/**
+	  Counters of a HttpListener, updated by all connection handlers. The counters start at 0 when the
+	  listener is created and are never reset, so rates can be calculated by reading them periodically.
+	  The gauges of the connection handler pool are updated in each cleanupInterval.
+	  All values can be read from any thread.
+	*/
+	class QTWEBAPP_EXPORT HttpServerStatistics {
+		Q_DISABLE_COPY(HttpServerStatistics)
+
+	  public:
+		/** Constructor, all counters are 0 */
+		HttpServerStatistics() {}
+
+		/// The number of accepted connections.
+		QAtomicInteger<qint64> connections;
+
+		/// The number of completed TLS handshakes.
+		QAtomicInteger<qint64> tlsHandshakes;
+
+		/// The number of TLS connections that have been closed before the handshake completed.
+		QAtomicInteger<qint64> tlsHandshakeFailures;
+
+		/// The number of connections that had to wait for a free connection handler.
+		QAtomicInteger<qint64> queuedConnections;
+
+		/// The total time in milliseconds that connections waited for a free connection handler.
+		QAtomicInteger<qint64> queueTime;
+
+		/// The longest time in milliseconds that a connection waited for a free connection handler.
+		QAtomicInteger<qint64> maxQueueTime;
+
+		/// The number of connections rejected with 503, including the shed connections.
+		QAtomicInteger<qint64> rejectedConnections;
+
+		/// The number of waiting connections rejected with 503 to reduce the queue time under overload.
+		QAtomicInteger<qint64> shedConnections;
+
+		/// The number of connections rejected with 429 because the client had too many connections.
+		QAtomicInteger<qint64> limitedConnections;
+
+		/// The number of requests rejected with 429 because the client exceeded its request rate.
+		QAtomicInteger<qint64> limitedRequests;
+
+		/// The number of connections closed because the headers or the body of a request did not arrive in time.
+		QAtomicInteger<qint64> requestTimeouts;
+
+		/// The number of pipelined requests that have been serviced concurrently with other requests.
+		QAtomicInteger<qint64> pipelinedRequests;
+
+		/// The number of bytes read from files that could not be sent with sendfile(), see HttpFileReader.
+		QAtomicInteger<qint64> fileReadBytes;
+
+		/// The total time in microseconds that responses waited for these reads. Comparing fileReadWait per
+		/// fileReadBytes of builds with and without QTWEBAPP_IO_URING shows what the read-ahead saves.
+		QAtomicInteger<qint64> fileReadWait;
+
+		/// Gauge: the number of connections waiting for a free connection handler.
+		QAtomicInteger<qint64> acceptQueueLength;
+
+		/// Gauge: how many milliseconds a timer of the event loop that accepts connections fired late, measured
+		/// 10 times per second.
+		QAtomicInteger<qint64> eventLoopLag;
+
+		/// The highest eventLoopLag in milliseconds.
+		QAtomicInteger<qint64> maxEventLoopLag;
+
+		/// The number of connection handlers that have been created.
+		QAtomicInteger<qint64> handlersCreated;
+
+		/// The number of idle connection handlers that have been closed to shrink the pool.
+		QAtomicInteger<qint64> handlersRetired;
+
+		/// Gauge: the current number of connection handlers.
+		QAtomicInteger<qint64> poolSize;
+
+		/// Gauge: the number of busy connection handlers at the last decision of the pool policy.
+		QAtomicInteger<qint64> busyHandlers;
+
+		/// Gauge: the number of connection handlers decided by the pool policy.
+		QAtomicInteger<qint64> poolTargetSize;
+	};
+
+} // namespace qtwebapp
@@ -102,9 +102,7 @@ void StaticFileController::service(HttpRequest &request, HttpResponse &response)
 				mutex.unlock();
 			} else {
 				// Return the file content, do not store in cache
-				while (!file.atEnd() && !file.error()) {
-					response.write(file.read(65536));
-				}
+				response.writeFile(file);
 			}
 			file.close();
 		} else {
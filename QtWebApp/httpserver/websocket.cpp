@@ -0,0 +1,529 @@
+#include "websocket.h"
+
+#include <QCryptographicHash>
+#include <QList>
+
+#include <string.h>
+
+#ifdef CMAKE_QTWEBAPP_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace qtwebapp;
+
+/** Messages smaller than this are not compressed, the deflate overhead would make them larger */
+static const int minCompressSize = 64;
+
+/** Unmask a payload in place. Eight bytes are processed at once, the compiler may vectorize the loop further. */
+static void unmask(char *data, int size, const uchar *mask) {
+	quint32 mask32;
+	memcpy(&mask32, mask, 4);
+	quint64 mask64 = (quint64(mask32) << 32) | mask32;
+	int i = 0;
+	for (; i + 8 <= size; i += 8) {
+		quint64 chunk;
+		memcpy(&chunk, data + i, 8);
+		chunk ^= mask64;
+		memcpy(data + i, &chunk, 8);
+	}
+	for (; i < size; ++i) {
+		data[i] ^= mask[i & 3];
+	}
+}
+
+/** Check whether the data is valid UTF-8, without overlong encodings and surrogates */
+static bool isValidUtf8(const char *data, int size) {
+	const uchar *s = reinterpret_cast<const uchar *>(data);
+	int i = 0;
+	while (i < size) {
+		// Skip ASCII text eight bytes at once
+		if (i + 8 <= size) {
+			quint64 chunk;
+			memcpy(&chunk, s + i, 8);
+			if ((chunk & Q_UINT64_C(0x8080808080808080)) == 0) {
+				i += 8;
+				continue;
+			}
+		}
+		uchar c = s[i];
+		if (c < 0x80) {
+			++i;
+			continue;
+		}
+		int n;
+		quint32 codePoint;
+		if ((c & 0xe0) == 0xc0) {
+			n = 1;
+			codePoint = c & 0x1f;
+		} else if ((c & 0xf0) == 0xe0) {
+			n = 2;
+			codePoint = c & 0x0f;
+		} else if ((c & 0xf8) == 0xf0) {
+			n = 3;
+			codePoint = c & 0x07;
+		} else {
+			return false;
+		}
+		if (i + n >= size) {
+			return false;
+		}
+		for (int k = 1; k <= n; ++k) {
+			if ((s[i + k] & 0xc0) != 0x80) {
+				return false;
+			}
+			codePoint = (codePoint << 6) | (s[i + k] & 0x3f);
+		}
+		if ((n == 1 && codePoint < 0x80) || (n == 2 && codePoint < 0x800) || (n == 3 && codePoint < 0x10000) ||
+		    codePoint > 0x10ffff || (codePoint >= 0xd800 && codePoint <= 0xdfff)) {
+			return false;
+		}
+		i += n + 1;
+	}
+	return true;
+}
+
+WebSocket::WebSocket(const HttpServerConfig &cfg) : QObject(), cfg(cfg) {
+	socket = nullptr;
+	messageOpcode = continuation;
+	messageCompressed = false;
+	closeSent = false;
+	clientNoContextTakeover = false;
+	inflater = nullptr;
+	deflater = nullptr;
+	closeTimer = new QTimer(this);
+	closeTimer->setSingleShot(true);
+	connect(closeTimer, SIGNAL(timeout()), SLOT(closeTimeout()));
+}
+
+WebSocket::~WebSocket() {
+#ifdef CMAKE_QTWEBAPP_ZLIB
+	if (inflater) {
+		inflateEnd(inflater);
+		delete inflater;
+	}
+	if (deflater) {
+		deflateEnd(deflater);
+		delete deflater;
+	}
+#endif
+#ifdef CMAKE_DEBUG
+	qDebug("WebSocket (%p): destroyed", static_cast<void *>(this));
+#endif
+}
+
+QByteArray WebSocket::acceptKey(const QByteArray &key) {
+	return QCryptographicHash::hash(key.trimmed() + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", QCryptographicHash::Sha1)
+	    .toBase64();
+}
+
+QHostAddress WebSocket::getPeerAddress() const {
+	return peerAddress;
+}
+
+QByteArray WebSocket::negotiateCompression(const QByteArray &offers) {
+#ifdef CMAKE_QTWEBAPP_ZLIB
+	// Accept the first offer of permessage-deflate with parameters that we support
+	foreach (const QByteArray &offer, offers.split(',')) {
+		QList<QByteArray> params = offer.split(';');
+		if (params.takeFirst().trimmed() != "permessage-deflate") {
+			continue;
+		}
+		bool ok = true;
+		int serverWindowBits = 15;
+		bool clientNoContext = false;
+		foreach (const QByteArray &param, params) {
+			int equals = param.indexOf('=');
+			QByteArray name = (equals < 0 ? param : param.left(equals)).trimmed();
+			QByteArray value = equals < 0 ? QByteArray() : param.mid(equals + 1).trimmed();
+			if (value.startsWith('"') && value.endsWith('"') && value.size() >= 2) {
+				value = value.mid(1, value.size() - 2);
+			}
+			if (name == "server_no_context_takeover") {
+				// The server never takes over the context anyway
+			} else if (name == "client_no_context_takeover") {
+				clientNoContext = true;
+			} else if (name == "server_max_window_bits") {
+				// zlib does not support a window of 8 bits for raw deflate
+				int bits = value.toInt(&ok);
+				if (ok && bits >= 9 && bits <= 15) {
+					serverWindowBits = bits;
+				} else {
+					ok = false;
+				}
+			} else if (name == "client_max_window_bits") {
+				// The inflater always uses the largest window, which decodes all smaller windows
+				if (!value.isEmpty()) {
+					int bits = value.toInt(&ok);
+					ok = ok && bits >= 8 && bits <= 15;
+				}
+			} else {
+				ok = false;
+			}
+			if (!ok) {
+				break;
+			}
+		}
+		if (!ok) {
+			continue;
+		}
+
+		inflater = new z_stream;
+		memset(inflater, 0, sizeof(z_stream));
+		deflater = new z_stream;
+		memset(deflater, 0, sizeof(z_stream));
+		if (inflateInit2(inflater, -15) != Z_OK ||
+		    deflateInit2(deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -serverWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			qCritical("WebSocket (%p): cannot initialize zlib", static_cast<void *>(this));
+			return QByteArray();
+		}
+		clientNoContextTakeover = clientNoContext;
+
+		// The server resets its context after each message, so the client needs less memory
+		QByteArray response = "permessage-deflate; server_no_context_takeover";
+		if (serverWindowBits < 15) {
+			response.append("; server_max_window_bits=");
+			response.append(QByteArray::number(serverWindowBits));
+		}
+		if (clientNoContext) {
+			response.append("; client_no_context_takeover");
+		}
+		return response;
+	}
+#else
+	Q_UNUSED(offers)
+#endif
+	return QByteArray();
+}
+
+void WebSocket::open(QTcpSocket *socket, QThread *thread) {
+	this->socket = socket;
+	peerAddress = socket->peerAddress();
+	socket->setParent(this);
+	connect(socket, SIGNAL(readyRead()), SLOT(read()));
+	connect(socket, SIGNAL(disconnected()), SLOT(socketDisconnected()));
+	connect(thread, SIGNAL(finished()), SLOT(threadDone()));
+	moveToThread(thread);
+	// The client may have sent frames together with the handshake
+	QMetaObject::invokeMethod(this, "read", Qt::QueuedConnection);
+#ifdef CMAKE_DEBUG
+	qDebug("WebSocket (%p): opened", static_cast<void *>(this));
+#endif
+}
+
+void WebSocket::sendTextMessage(const QString &message) {
+	QMetaObject::invokeMethod(this, "sendMessage", Qt::QueuedConnection, Q_ARG(int, text),
+	                          Q_ARG(QByteArray, message.toUtf8()));
+}
+
+void WebSocket::sendBinaryMessage(const QByteArray &message) {
+	QMetaObject::invokeMethod(this, "sendMessage", Qt::QueuedConnection, Q_ARG(int, binary), Q_ARG(QByteArray, message));
+}
+
+void WebSocket::ping(const QByteArray &payload) {
+	QMetaObject::invokeMethod(this, "sendMessage", Qt::QueuedConnection, Q_ARG(int, pingFrame),
+	                          Q_ARG(QByteArray, payload.left(125)));
+}
+
+void WebSocket::close(int code, const QString &reason) {
+	QByteArray payload;
+	payload.append(char(code >> 8));
+	payload.append(char(code & 0xff));
+	payload.append(reason.toUtf8().left(123));
+	QMetaObject::invokeMethod(this, "sendMessage", Qt::QueuedConnection, Q_ARG(int, closeFrame),
+	                          Q_ARG(QByteArray, payload));
+}
+
+void WebSocket::sendMessage(int opcode, const QByteArray &payload) {
+	if (!socket || socket->state() != QAbstractSocket::ConnectedState || closeSent) {
+		return;
+	}
+	if (opcode == closeFrame) {
+		writeFrame(closeFrame, payload);
+		closeSent = true;
+		closeTimer->start(cfg.readTimeout);
+		return;
+	}
+	// A client that does not read its messages must not fill the memory of the server
+	if (socket->bytesToWrite() > cfg.webSocketWriteBufferSize) {
+		qWarning("WebSocket (%p): client does not read fast enough, closing the connection",
+		         static_cast<void *>(this));
+		socket->abort();
+		return;
+	}
+	if (deflater && opcode != pingFrame && payload.size() >= minCompressSize) {
+		writeFrame(opcode, deflateMessage(payload), true);
+	} else {
+		writeFrame(opcode, payload);
+	}
+}
+
+void WebSocket::writeFrame(int opcode, const QByteArray &payload, bool rsv1) {
+	QByteArray frame;
+	frame.reserve(payload.size() + 10);
+	frame.append(char(0x80 | (rsv1 ? 0x40 : 0) | opcode));
+	if (payload.size() < 126) {
+		frame.append(char(payload.size()));
+	} else if (payload.size() < 65536) {
+		frame.append(char(126));
+		frame.append(char(payload.size() >> 8));
+		frame.append(char(payload.size() & 0xff));
+	} else {
+		frame.append(char(127));
+		for (int i = 7; i >= 0; --i) {
+			frame.append(char((quint64(payload.size()) >> (8 * i)) & 0xff));
+		}
+	}
+	frame.append(payload);
+	// The socket buffers the frame and sends it from the event loop, so this does not block
+	socket->write(frame);
+}
+
+void WebSocket::read() {
+	if (!socket) {
+		return;
+	}
+	if (socket->state() != QAbstractSocket::ConnectedState) {
+		socket->readAll();
+		return;
+	}
+	inputBuffer.append(socket->readAll());
+	receiveFrames();
+}
+
+void WebSocket::receiveFrames() {
+	int pos = 0;
+	while (true) {
+		const uchar *data = reinterpret_cast<const uchar *>(inputBuffer.constData()) + pos;
+		int available = inputBuffer.size() - pos;
+		if (available < 2) {
+			break;
+		}
+		bool fin = data[0] & 0x80;
+		bool rsv1 = data[0] & 0x40;
+		int opcode = data[0] & 0x0f;
+		quint64 length = data[1] & 0x7f;
+		int headerSize = 2;
+		if (length == 126) {
+			if (available < 4) {
+				break;
+			}
+			length = (quint64(data[2]) << 8) | data[3];
+			headerSize = 4;
+		} else if (length == 127) {
+			if (available < 10) {
+				break;
+			}
+			length = 0;
+			for (int i = 2; i < 10; ++i) {
+				length = (length << 8) | data[i];
+			}
+			headerSize = 10;
+		}
+
+		// Check the header before the payload is collected
+		if (!(data[1] & 0x80)) {
+			fail(protocolError, "received unmasked frame");
+			return;
+		}
+		if ((data[0] & 0x30) || (rsv1 && (!inflater || opcode == continuation || opcode >= closeFrame))) {
+			fail(protocolError, "received frame with reserved bits");
+			return;
+		}
+		if (length + quint64(message.size()) > quint64(cfg.webSocketMaxMessageSize)) {
+			fail(messageTooBig, "message is too large");
+			return;
+		}
+		int frameSize = headerSize + 4 + int(length);
+		if (available < frameSize) {
+			break;
+		}
+
+		QByteArray payload(reinterpret_cast<const char *>(data) + headerSize + 4, int(length));
+		unmask(payload.data(), payload.size(), data + headerSize);
+		pos += frameSize;
+		if (!processFrame(opcode, fin, rsv1, payload)) {
+			return;
+		}
+	}
+	inputBuffer.remove(0, pos);
+}
+
+bool WebSocket::processFrame(int opcode, bool fin, bool rsv1, QByteArray &payload) {
+	// Control frames may be sent between the fragments of a message
+	if (opcode >= closeFrame) {
+		if (!fin || payload.size() > 125) {
+			fail(protocolError, "invalid control frame");
+			return false;
+		}
+		switch (opcode) {
+			case closeFrame: {
+				if (payload.size() == 1) {
+					fail(protocolError, "invalid close frame");
+					return false;
+				}
+				if (payload.size() >= 2) {
+					int code = (uchar(payload.at(0)) << 8) | uchar(payload.at(1));
+					bool validCode = (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) ||
+					                 (code >= 3000 && code <= 4999);
+					if (!validCode || !isValidUtf8(payload.constData() + 2, payload.size() - 2)) {
+						fail(protocolError, "invalid close frame");
+						return false;
+					}
+				}
+#ifdef CMAKE_DEBUG
+				qDebug("WebSocket (%p): received close frame", static_cast<void *>(this));
+#endif
+				// Answer the closing handshake, the server closes the TCP connection first
+				if (!closeSent) {
+					writeFrame(closeFrame, payload.left(2));
+					closeSent = true;
+				}
+				socket->disconnectFromHost();
+				return false;
+			}
+			case pingFrame: writeFrame(pongFrame, payload); return true;
+			case pongFrame: emit pong(payload); return true;
+			default: fail(protocolError, "received unknown opcode"); return false;
+		}
+	}
+
+	if (opcode == continuation) {
+		if (messageOpcode == continuation) {
+			fail(protocolError, "received unexpected continuation frame");
+			return false;
+		}
+		message.append(payload);
+		if (!fin) {
+			return true;
+		}
+		QByteArray complete;
+		complete.swap(message);
+		int completeOpcode = messageOpcode;
+		messageOpcode = continuation;
+		return processMessage(completeOpcode, complete);
+	}
+
+	if (opcode != text && opcode != binary) {
+		fail(protocolError, "received unknown opcode");
+		return false;
+	}
+	if (messageOpcode != continuation) {
+		fail(protocolError, "expected continuation frame");
+		return false;
+	}
+	messageCompressed = rsv1;
+	if (fin) {
+		return processMessage(opcode, payload);
+	}
+	messageOpcode = opcode;
+	message.swap(payload);
+	return true;
+}
+
+bool WebSocket::processMessage(int opcode, QByteArray &payload) {
+	if (messageCompressed) {
+		int error = inflateMessage(payload);
+		if (error) {
+			fail(error, "cannot decompress message");
+			return false;
+		}
+	}
+	if (opcode == text) {
+		if (!isValidUtf8(payload.constData(), payload.size())) {
+			fail(invalidPayload, "text message is not valid UTF-8");
+			return false;
+		}
+		emit textMessageReceived(QString::fromUtf8(payload));
+	} else {
+		emit binaryMessageReceived(payload);
+	}
+	return true;
+}
+
+int WebSocket::inflateMessage(QByteArray &payload) {
+#ifdef CMAKE_QTWEBAPP_ZLIB
+	// The sender removed the marker of the final empty block
+	payload.append("\x00\x00\xff\xff", 4);
+	inflater->next_in = reinterpret_cast<Bytef *>(payload.data());
+	inflater->avail_in = uInt(payload.size());
+	QByteArray result;
+	char buffer[16384];
+	do {
+		inflater->next_out = reinterpret_cast<Bytef *>(buffer);
+		inflater->avail_out = sizeof(buffer);
+		int ret = inflate(inflater, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END) {
+			return invalidPayload;
+		}
+		result.append(buffer, int(sizeof(buffer) - inflater->avail_out));
+		if (result.size() > cfg.webSocketMaxMessageSize) {
+			return messageTooBig;
+		}
+	} while (inflater->avail_out == 0);
+	if (clientNoContextTakeover) {
+		inflateReset(inflater);
+	}
+	payload.swap(result);
+	return 0;
+#else
+	Q_UNUSED(payload)
+	return unsupportedData;
+#endif
+}
+
+QByteArray WebSocket::deflateMessage(const QByteArray &payload) {
+	QByteArray result;
+#ifdef CMAKE_QTWEBAPP_ZLIB
+	result.reserve(payload.size() / 2 + 64);
+	deflater->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(payload.constData()));
+	deflater->avail_in = uInt(payload.size());
+	char buffer[16384];
+	do {
+		deflater->next_out = reinterpret_cast<Bytef *>(buffer);
+		deflater->avail_out = sizeof(buffer);
+		deflate(deflater, Z_SYNC_FLUSH);
+		result.append(buffer, int(sizeof(buffer) - deflater->avail_out));
+	} while (deflater->avail_out == 0);
+	// Remove the marker of the final empty block, and start the next message with a new context
+	result.chop(4);
+	deflateReset(deflater);
+#else
+	Q_UNUSED(payload)
+#endif
+	return result;
+}
+
+void WebSocket::fail(int code, const char *reason) {
+	qWarning("WebSocket (%p): %s", static_cast<void *>(this), reason);
+	if (!closeSent) {
+		QByteArray payload;
+		payload.append(char(code >> 8));
+		payload.append(char(code & 0xff));
+		writeFrame(closeFrame, payload);
+		closeSent = true;
+	}
+	socket->disconnectFromHost();
+}
+
+void WebSocket::closeTimeout() {
+	qWarning("WebSocket (%p): client did not answer the closing handshake", static_cast<void *>(this));
+	socket->abort();
+}
+
+void WebSocket::socketDisconnected() {
+#ifdef CMAKE_DEBUG
+	qDebug("WebSocket (%p): disconnected", static_cast<void *>(this));
+#endif
+	closeTimer->stop();
+	emit disconnected();
+	deleteLater();
+}
+
+void WebSocket::drain() {
+	close(goingAway, "server shutdown");
+}
+
+void WebSocket::threadDone() {
+	socket->abort();
+	delete this;
+}
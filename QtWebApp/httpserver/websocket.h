@@ -0,0 +1,202 @@
+#pragma once
+
+#include "httpserverconfig.h"
+#include "qtwebappglobal.h"
+
+#include <QByteArray>
+#include <QHostAddress>
+#include <QObject>
+#include <QString>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+
+struct z_stream_s;
+
+namespace qtwebapp {
+
+	class HttpConnectionHandler;
+
+	/**
+	  Server side of a WebSocket connection (RFC 6455). The request handler accepts the upgrade of a request in
+	  HttpRequestHandler::acceptWebSocket() and connects the signals of the WebSocket to its own objects. After the
+	  101 response has been sent, the socket is handed over from the connection handler to the WebSocket, so the
+	  connection handler is free for the next connection.
+	  <p>
+	  All WebSockets of a listener share a single thread, they do not occupy a connection handler or a thread of
+	  their own. Signals are emitted in that thread, so they should be connected to objects of other threads with
+	  queued connections (which is the default). The send methods and close() are thread safe.
+	  <p>
+	  Messages may be fragmented by the client. Compression with permessage-deflate (RFC 7692) is supported if
+	  QtWebApp has been built with zlib.
+	  <p>
+	  Example for the configuration settings:
+	  <code><pre>
+	  webSocketMaxMessageSize=1048576
+	  webSocketWriteBufferSize=1048576
+	  </pre></code>
+	  The WebSocket deletes itself after the connection has been closed.
+	*/
+	class QTWEBAPP_EXPORT WebSocket : public QObject {
+		Q_OBJECT
+		Q_DISABLE_COPY(WebSocket)
+		friend class HttpConnectionHandler;
+
+	  public:
+		/** Status codes of close frames */
+		enum CloseCode {
+			normalClosure = 1000,
+			goingAway = 1001,
+			protocolError = 1002,
+			unsupportedData = 1003,
+			noStatusReceived = 1005,
+			abnormalClosure = 1006,
+			invalidPayload = 1007,
+			policyViolation = 1008,
+			messageTooBig = 1009,
+			internalError = 1011
+		};
+
+		/**
+		  Constructor, used by the connection handler before the upgrade is accepted.
+		  @param cfg Configuration of the HTTP server
+		*/
+		WebSocket(const HttpServerConfig &cfg);
+
+		/** Destructor */
+		virtual ~WebSocket();
+
+		/** Send a text message. This method is thread safe. */
+		void sendTextMessage(const QString &message);
+
+		/** Send a binary message. This method is thread safe. */
+		void sendBinaryMessage(const QByteArray &message);
+
+		/** Send a ping, the client answers with a pong. This method is thread safe. */
+		void ping(const QByteArray &payload = QByteArray());
+
+		/**
+		  Start the closing handshake. The connection is closed when the client answers, or after the read timeout.
+		  This method is thread safe.
+		*/
+		void close(int code = normalClosure, const QString &reason = QString());
+
+		/** Get the address of the client */
+		QHostAddress getPeerAddress() const;
+
+		/** Calculate the Sec-WebSocket-Accept header for the Sec-WebSocket-Key header of a request */
+		static QByteArray acceptKey(const QByteArray &key);
+
+	  signals:
+
+		/** Emitted when a complete text message has been received */
+		void textMessageReceived(const QString &message);
+
+		/** Emitted when a complete binary message has been received */
+		void binaryMessageReceived(const QByteArray &message);
+
+		/** Emitted when the client answered a ping */
+		void pong(const QByteArray &payload);
+
+		/** Emitted when the connection has been closed. The WebSocket is deleted afterwards. */
+		void disconnected();
+
+	  private:
+		/** Frame types */
+		enum Opcode { continuation = 0x0, text = 0x1, binary = 0x2, closeFrame = 0x8, pingFrame = 0x9, pongFrame = 0xa };
+
+		/** Configuration */
+		HttpServerConfig cfg;
+
+		/** The connection, or nullptr before the upgrade */
+		QTcpSocket *socket;
+
+		/** Address of the client */
+		QHostAddress peerAddress;
+
+		/** Closes the connection if the client does not answer the closing handshake */
+		QTimer *closeTimer;
+
+		/** Received data that does not form a complete frame yet */
+		QByteArray inputBuffer;
+
+		/** Payloads of the fragments of the current message */
+		QByteArray message;
+
+		/** Opcode of the current fragmented message, or continuation if there is none */
+		int messageOpcode;
+
+		/** Whether the current message is compressed */
+		bool messageCompressed;
+
+		/** Whether a close frame has been sent */
+		bool closeSent;
+
+		/** Whether the client resets its compression context after each message */
+		bool clientNoContextTakeover;
+
+		/** Decompresses received messages, or nullptr if compression is not used */
+		z_stream_s *inflater;
+
+		/** Compresses sent messages, or nullptr if compression is not used */
+		z_stream_s *deflater;
+
+		/**
+		  Negotiate permessage-deflate.
+		  @param offers Value of the Sec-WebSocket-Extensions request header
+		  @return Value of the Sec-WebSocket-Extensions response header, empty if compression is not used
+		*/
+		QByteArray negotiateCompression(const QByteArray &offers);
+
+		/** Take over the connection after the 101 response has been sent */
+		void open(QTcpSocket *socket, QThread *thread);
+
+		/** Parse and process all complete frames that have been received. */
+		void receiveFrames();
+
+		/**
+		  Process a single unmasked frame.
+		  @return False if the connection has been failed
+		*/
+		bool processFrame(int opcode, bool fin, bool rsv1, QByteArray &payload);
+
+		/** Process a complete message */
+		bool processMessage(int opcode, QByteArray &payload);
+
+		/** Send a close frame with a status code and close the connection because of an error of the client */
+		void fail(int code, const char *reason);
+
+		/** Send a frame, rsv1 marks a compressed payload */
+		void writeFrame(int opcode, const QByteArray &payload, bool rsv1 = false);
+
+		/**
+		  Decompress a message.
+		  @return 0 on success, otherwise the close code for the error
+		*/
+		int inflateMessage(QByteArray &payload);
+
+		/** Compress a message */
+		QByteArray deflateMessage(const QByteArray &payload);
+
+	  private slots:
+
+		/** Received from the socket when incoming data can be read */
+		void read();
+
+		/** Send a data or control frame, invoked by the thread safe public methods */
+		void sendMessage(int opcode, const QByteArray &payload);
+
+		/** Received from the socket when the connection has been closed */
+		void socketDisconnected();
+
+		/** Received from the close timer when the client does not answer the closing handshake */
+		void closeTimeout();
+
+		/** Close the connection when the thread finishes */
+		void threadDone();
+
+		/** Received from the connection handler when the server shuts down, starts the closing handshake */
+		void drain();
+	};
+
+} // namespace qtwebapp